@@ -34,6 +34,17 @@ struct basic_aabb
         return total;
     }
 
+    // the sum of the face areas, used as the SAH cost metric
+    float surface_area() const
+    {
+        auto size = max - min;
+        float total = 0.0f;
+        for (int i = 0; i < T::length(); ++i) {
+            total += size[i] * size[(i + 1) % T::length()];
+        }
+        return 2.0f * total;
+    }
+
     bool overlap(const basic_aabb& rhs) const
     {
         for (int i = 0; i < T::length(); ++i) {
@@ -0,0 +1,84 @@
+#include "alloc_stats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<std::size_t> g_allocations(0);
+std::atomic<std::size_t> g_bytes(0);
+std::atomic<std::size_t> g_peakBytes(0);
+
+} // anonymous namespace
+
+#ifdef RAYTRACER_ALLOC_STATS
+
+namespace
+{
+
+// the size of the block is stored in front of it to track the usage on delete
+constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+
+void* allocate(std::size_t size)
+{
+    auto p = static_cast<char*>(std::malloc(size + HeaderSize));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<std::size_t*>(p) = size;
+
+    ++g_allocations;
+    auto bytes = g_bytes += size;
+    auto peak = g_peakBytes.load();
+    while (bytes > peak && !g_peakBytes.compare_exchange_weak(peak, bytes)) {
+    }
+    return p + HeaderSize;
+}
+
+void deallocate(void* ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    auto p = static_cast<char*>(ptr) - HeaderSize;
+    g_bytes -= *reinterpret_cast<std::size_t*>(p);
+    std::free(p);
+}
+
+} // anonymous namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, std::size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, std::size_t) noexcept { deallocate(p); }
+
+#endif // RAYTRACER_ALLOC_STATS
+
+namespace alloc_stats
+{
+
+bool enabled()
+{
+#ifdef RAYTRACER_ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+counters get()
+{
+    return { g_allocations.load(), g_bytes.load(), g_peakBytes.load() };
+}
+
+void reset()
+{
+    g_allocations = 0;
+    g_peakBytes = g_bytes.load();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#pragma once
+
+#include <cstddef>
+
+// heap statistics collected by the global operator new when the build
+// defines RAYTRACER_ALLOC_STATS, all zeros otherwise
+namespace alloc_stats
+{
+
+struct counters
+{
+    std::size_t allocations;
+    std::size_t bytes;
+    std::size_t peak_bytes;
+};
+
+bool enabled();
+counters get();
+// restart the allocation count and the peak from the current usage
+void reset();
+
+}
+
+#endif // ALLOC_STATS_H
\ No newline at end of file
@@ -1,7 +1,14 @@
 #include "application.h"
 #include "glutils.h"
+#include "framepacer.h"
+#include "headlesscontext.h"
+#include "imagefile.h"
+#include "thread_pool.h"
+#include "checkpoint.h"
 
 #include <glad/glad.h>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <cassert>
 #include <stdexcept>
@@ -13,16 +20,28 @@ namespace
 }
 
 Application::Application(const RenderConfig& config)
+    : m_window(nullptr)
+    , m_output(config.output)
+    , m_renderComplete(false)
+    , m_snapshotPath(config.snapshotPath)
 {
     init(config);
 }
 
 Application::~Application()
 {
-    glfwTerminate();
+    if (m_fileWrites) {
+        m_fileWrites->wait();
+    }
+    // the renderer frees its gl objects while the context is alive
+    m_pacer.reset();
+    m_renderer.reset();
+    if (!m_headless) {
+        glfwTerminate();
+    }
 }
 
-void Application::init(const RenderConfig& config)
+void Application::createWindow(const RenderConfig& config)
 {
     if (!glfwInit()) {
         throw std::runtime_error("failed to initialize glfw");
@@ -52,18 +71,30 @@ void Application::init(const RenderConfig& config)
     glfwMakeContextCurrent(m_window);
     glfwSetKeyCallback(m_window, onKeyPressedCallback);
     glfwSetWindowUserPointer(m_window, this);
-    
+}
+
+void Application::init(const RenderConfig& config)
+{
+    if (config.headless) {
+        if (config.numSamples <= 0 && config.noiseThreshold <= 0) {
+            throw std::runtime_error("a headless render needs a sample count or a noise threshold to stop at");
+        }
+        m_headless = std::make_unique<HeadlessContext>(config.width, config.height, true);
+    } else {
+        createWindow(config);
+    }
+
     if (!ogl_LoadFunctions()) {
         throw std::runtime_error("failed to load ogl");
     }
 
     if (config.shaderInput == ShaderInput::ShaderStorageBuffer && 
-        !glfwExtensionSupported("GL_ARB_shader_storage_buffer_object")) {
+        !GLUtils::extensionSupported("GL_ARB_shader_storage_buffer_object")) {
         throw std::runtime_error("ssbo input is not supported");
     }
 
     if (config.shaderType == ShaderType::ComputeShader && 
-        !glfwExtensionSupported("GL_ARB_compute_shader")) {
+        !GLUtils::extensionSupported("GL_ARB_compute_shader")) {
         throw std::runtime_error("compute shader is not supported");
     }
 
@@ -77,20 +108,47 @@ void Application::init(const RenderConfig& config)
 #endif
 
     RenderConfig tmpConfig = config;
-    glfwGetFramebufferSize(m_window, &tmpConfig.width, &tmpConfig.height);
+    if (m_window) {
+        glfwGetFramebufferSize(m_window, &tmpConfig.width, &tmpConfig.height);
+    }
     glViewport(0, 0, tmpConfig.width, tmpConfig.height);
+    m_width = tmpConfig.width;
+    m_height = tmpConfig.height;
     m_renderer = std::make_unique<Renderer>(tmpConfig);
     m_renderer->onRenderComplete([&] { onRenderComplete(); });
-    glfwSwapInterval(0);
+    if (config.snapshotEvery > 0 || config.checkpointEvery > 0) {
+        // the calling thread and one writing
+        m_writePool = std::make_unique<thread_pool>(2);
+        m_fileWrites = std::make_unique<task_group>(m_writePool.get());
+    }
+    if (config.snapshotEvery > 0) {
+        m_renderer->onSnapshot([&](int progress, std::vector<glm::vec3> image) {
+            onSnapshot(progress, std::move(image));
+        });
+    }
+    if (config.checkpointEvery > 0) {
+        m_checkpoints = std::make_unique<CheckpointWriter>(config.checkpointPath);
+        m_renderer->onCheckpoint([&](Checkpoint checkpoint) { onCheckpoint(std::move(checkpoint)); });
+    }
+    m_pacer = std::make_unique<FramePacer>(config.framesInFlight);
+    if (m_window) {
+        glfwSwapInterval(0);
+    }
 }
 
 void Application::run()
 {
+    if (m_headless) {
+        runHeadless();
+        return;
+    }
     assert(m_window);
 
     int frames = 0;
     double accum = 0;
     double lastTime = glfwGetTime();
+    int totalFrames = 0;
+    double startTime = lastTime;
     while (!glfwWindowShouldClose(m_window)) {
         double curTime = glfwGetTime();
         accum += curTime - lastTime;
@@ -106,15 +164,90 @@ void Application::run()
 
         glfwPollEvents();
 
+        // the uniforms of this frame are set while the gpu still runs the previous ones
+        m_pacer->beginFrame();
         m_renderer->render();
-        glFinish();
+        m_pacer->endFrame();
         glfwSwapBuffers(m_window);
+        ++totalFrames;
+
+        auto error = glGetError();
+        if (error != GL_NO_ERROR) {
+            std::cerr << error << "\n";
+        }
+    }
+
+    finishReadbacks();
+    double elapsed = glfwGetTime() - startTime;
+    std::cout << "Frames: " << totalFrames << " at " << totalFrames / elapsed << "/s, "
+              << m_pacer->framesInFlight() << " in flight, " << m_pacer->waitMs() << "ms waited\n";
+}
+
+void Application::runHeadless()
+{
+    auto start = std::chrono::steady_clock::now();
+    int frames = 0;
+    while (!m_renderComplete) {
+        m_pacer->beginFrame();
+        m_renderer->render();
+        m_pacer->endFrame();
+        ++frames;
 
         auto error = glGetError();
         if (error != GL_NO_ERROR) {
             std::cerr << error << "\n";
         }
     }
+    finishReadbacks();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    saveImage(m_output, m_width, m_height, m_renderer->readImage());
+    std::cout << "Frames: " << frames << " at " << frames / elapsed.count() << "/s, "
+              << m_pacer->framesInFlight() << " in flight, " << m_pacer->waitMs() << "ms waited\n";
+    std::cout << "Total Time: " << elapsed.count() << "s, wrote " << m_output << "\n";
+}
+
+void Application::onSnapshot(int progress, std::vector<glm::vec3> image)
+{
+    // render.png is written to render_0010.png after 10 samples
+    std::string path = m_snapshotPath;
+    auto dot = path.find_last_of('.');
+    auto slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = path.size();
+    }
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "_%04d", progress);
+    path.insert(dot, suffix);
+
+    int width = m_width;
+    int height = m_height;
+    m_fileWrites->run([path, width, height, image = std::move(image)] {
+        try {
+            saveImage(path, width, height, image);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+    });
+}
+
+void Application::onCheckpoint(Checkpoint checkpoint)
+{
+    m_fileWrites->run([this, checkpoint = std::move(checkpoint)] {
+        try {
+            m_checkpoints->write(checkpoint, checkpoint.samples);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+    });
+}
+
+void Application::finishReadbacks()
+{
+    if (m_fileWrites) {
+        m_renderer->finishReadbacks();
+        m_fileWrites->wait();
+    }
 }
 
 void Application::onKeyPressedCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -132,5 +265,8 @@ void Application::onKeyPressed(int key, int action)
 
 void Application::onRenderComplete()
 {
-    glfwSwapInterval(1);
+    m_renderComplete = true;
+    if (m_window) {
+        glfwSwapInterval(1);
+    }
 }
\ No newline at end of file
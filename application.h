@@ -7,8 +7,16 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <memory>
+#include <string>
+#include <vector>
 
 class Renderer;
+class FramePacer;
+class HeadlessContext;
+class task_group;
+class thread_pool;
+class CheckpointWriter;
+struct Checkpoint;
 struct RenderConfig;
 
 class Application
@@ -20,13 +28,37 @@ public:
     void run();
 private:
     void init(const RenderConfig& config);
+    void createWindow(const RenderConfig& config);
+    // render until the render is complete and write the image
+    void runHeadless();
     void onRenderComplete();
+    // write the snapshot or the checkpoint on the write thread
+    void onSnapshot(int progress, std::vector<glm::vec3> image);
+    void onCheckpoint(Checkpoint checkpoint);
+    // wait for the snapshots and the checkpoints to be read back and written
+    void finishReadbacks();
 
     static void onKeyPressedCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
     void onKeyPressed(int key, int action);
 
+    // null unless headless, the context outlives the renderer
+    std::unique_ptr<HeadlessContext> m_headless;
     std::unique_ptr<Renderer> m_renderer;
+    std::unique_ptr<FramePacer> m_pacer;
+    // null if headless
     GLFWwindow* m_window;
+    int m_width;
+    int m_height;
+    // the image the headless mode writes
+    std::string m_output;
+    bool m_renderComplete;
+    // the snapshots are written next to this path, empty for none
+    std::string m_snapshotPath;
+    std::unique_ptr<CheckpointWriter> m_checkpoints;
+    // a thread of its own writes the files while the frames are rendered,
+    // even if the shared pool has no threads besides the main one
+    std::unique_ptr<thread_pool> m_writePool;
+    std::unique_ptr<task_group> m_fileWrites;
 };
 
 #endif // APPLICATION_H 
\ No newline at end of file
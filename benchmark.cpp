@@ -0,0 +1,743 @@
+#include "benchmark.h"
+#include "alloc_stats.h"
+#include "bvh_node.h"
+#include "bvh_packet.h"
+#include "bvh_wide.h"
+#include "camera.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// the sphere counts to build the BVH for
+const int PrimitiveCounts[] = { 10000, 100000, 1000000 };
+
+// return the best time of the runs in milliseconds
+double measure(int runs, const std::function<void()>& f)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; ++i) {
+        auto start = Clock::now();
+        f();
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+int gridSizeFor(int numSpheres)
+{
+    return std::max(1, (int)std::lround(std::sqrt((double)numSpheres) / 2));
+}
+
+std::vector<object*> toObjects(std::vector<SphereObject>& spheres)
+{
+    std::vector<object*> objects;
+    for (auto& o : spheres) {
+        objects.push_back(&o);
+    }
+    return objects;
+}
+
+// hash the shape of the tree and the order of the leaf objects
+std::uint64_t hashTree(const bvh_tree& tree)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](std::uint64_t v) { hash = (hash ^ v) * 1099511628211ull; };
+    for (const auto& node : tree.nodes()) {
+        mix(node.left);
+        mix(node.right);
+        mix(node.first);
+        mix(node.count);
+    }
+    for (int i : tree.indices()) {
+        mix(i);
+    }
+    return hash;
+}
+
+// the expected cost of a ray hitting the root, in units of box tests,
+// assuming a sphere test costs as much as a box test
+float sahCost(const bvh_tree& tree)
+{
+    const auto& nodes = tree.nodes();
+    float rootArea = tree.root().volume.surface_area();
+    float cost = 0.0f;
+    for (const auto& node : nodes) {
+        float p = node.volume.surface_area() / rootArea;
+        cost += p * (node.is_leaf() ? node.count : 1);
+    }
+    return cost;
+}
+
+void benchmarkBvhBuild()
+{
+    std::printf("%12s %12s\n", "spheres", "build (ms)");
+    for (int count : PrimitiveCounts) {
+        auto spheres = createSpheres(gridSizeFor(count));
+        auto objects = toObjects(spheres);
+
+        int runs = count >= 1000000 ? 1 : 3;
+        double ms = measure(runs, [&] {
+            bvh_tree tree(objects.data(), objects.size());
+        });
+        std::printf("%12zu %12.2f\n", objects.size(), ms);
+    }
+}
+
+void benchmarkBvhScaling()
+{
+    const int count = 1000000;
+    auto spheres = createSpheres(gridSizeFor(count));
+    auto objects = toObjects(spheres);
+
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int n = 1; n < maxThreads; n *= 2) {
+        threadCounts.push_back(n);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::printf("%zu spheres\n", objects.size());
+    std::printf("%8s %12s %8s %18s\n", "threads", "build (ms)", "speedup", "tree hash");
+    double base = 0;
+    for (int n : threadCounts) {
+        thread_pool pool(n);
+        std::uint64_t hash = 0;
+        double ms = measure(3, [&] {
+            bvh_tree tree(objects.data(), objects.size(), &pool);
+            hash = hashTree(tree);
+        });
+        if (n == 1) {
+            base = ms;
+        }
+        std::printf("%8d %12.2f %8.2f %18llx\n", n, ms, base / ms, (unsigned long long)hash);
+    }
+}
+
+void benchmarkBvhBuilders()
+{
+    const struct {
+        bvh_builder builder;
+        const char* name;
+    } builders[] = {
+        { bvh_builder::sah, "sah" },
+        { bvh_builder::lbvh, "lbvh" },
+        { bvh_builder::hybrid, "hybrid" },
+    };
+
+    auto& pool = thread_pool::instance();
+    std::printf("%12s %8s %12s %10s %10s\n", "spheres", "builder", "build (ms)", "sah cost", "nodes");
+    for (int count : PrimitiveCounts) {
+        auto spheres = createSpheres(gridSizeFor(count));
+        auto objects = toObjects(spheres);
+
+        for (const auto& b : builders) {
+            float cost = 0;
+            size_t numNodes = 0;
+            double ms = measure(3, [&] {
+                bvh_tree tree(objects.data(), objects.size(), &pool, b.builder);
+                cost = sahCost(tree);
+                numNodes = tree.nodes().size();
+            });
+            std::printf("%12zu %8s %12.2f %10.1f %10zu\n", objects.size(), b.name, ms, cost, numNodes);
+        }
+    }
+}
+
+void benchmarkBvhMemory()
+{
+    if (!alloc_stats::enabled()) {
+        std::printf("configure with -DRAYTRACER_ALLOC_STATS=ON to count the allocations\n");
+    }
+
+    auto& pool = thread_pool::instance();
+    std::printf("%12s %12s %14s %14s\n", "spheres", "allocations", "peak (KiB)", "kept (KiB)");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        Scene scene;
+        scene.objects = createSpheres(gridSize);
+        auto objects = toObjects(scene.objects);
+
+        // count the build of the hierarchy and the gpu buffer
+        alloc_stats::reset();
+        auto before = alloc_stats::get();
+        scene.bvh = std::make_unique<bvh_tree>(objects.data(), objects.size(), &pool);
+        SceneBuffer buffer(scene);
+        auto after = alloc_stats::get();
+
+        std::printf("%12zu %12zu %14.1f %14.1f\n", scene.objects.size(), after.allocations,
+                    (after.peak_bytes - before.bytes) / 1024.0, (after.bytes - before.bytes) / 1024.0);
+    }
+}
+
+void benchmarkBvhNodes()
+{
+    auto& pool = thread_pool::instance();
+    std::printf("%12s %8s %10s %14s %18s %8s\n", "spheres", "format", "nodes", "size (KiB)", "MiB / 1M spheres",
+                "stack");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        Scene scene;
+        scene.objects = createSpheres(gridSize);
+        auto objects = toObjects(scene.objects);
+        scene.bvh = std::make_unique<bvh_tree>(objects.data(), objects.size(), &pool);
+
+        auto report = [&](const char* format, const SceneBuffer& buffer, size_t numNodes, size_t bytes) {
+            double perMillion = bytes / (1024.0 * 1024.0) * 1e6 / scene.objects.size();
+            std::printf("%12zu %8s %10zu %14.1f %18.2f %8d\n", scene.objects.size(), format, numNodes,
+                        bytes / 1024.0, perMillion, buffer.stackSize);
+        };
+        SceneBuffer binary(scene);
+        report("binary", binary, binary.nodes.size(), binary.nodes.size() * sizeof(Node));
+        SceneBuffer compressed(scene, 2, true);
+        report("8-bit", compressed, compressed.compressedNodes.size(),
+               compressed.compressedNodes.size() * sizeof(CompressedNode));
+        for (int width : { 4, 8 }) {
+            SceneBuffer wide(scene, width);
+            char name[16];
+            std::snprintf(name, sizeof(name), "bvh%d", width);
+            report(name, wide, wide.wideNodes.size() / wide.wideNodeSize, wide.wideNodes.size());
+        }
+    }
+}
+
+// the rays of the default camera through the pixel centers of a width x height image
+std::vector<ray> cameraRays(int width, int height)
+{
+    auto camera = defaultCamera();
+    glm::vec2 size(width, height);
+    std::vector<ray> rays;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            rays.push_back(camera.getRay(glm::vec2(x + 0.5f, y + 0.5f), size));
+        }
+    }
+    return rays;
+}
+
+// one diffuse bounce off the closest hit of each of the rays that hits
+std::vector<ray> bounceRays(const bvh_tree& tree, const std::vector<SphereObject>& spheres,
+                            const std::vector<ray>& rays)
+{
+    std::vector<ray> bounce;
+    for (const auto& r : rays) {
+        float tmax = FLT_MAX;
+        int hit = tree.closest_hit(r, 0.0001f, tmax, [&](int i, float tmin, float tmax) {
+            return spheres[i].hit(r, tmin, tmax);
+        });
+        if (hit != -1) {
+            glm::vec3 pt = r.origin + tmax * r.dir;
+            glm::vec3 normal = glm::normalize(pt - spheres[hit].center);
+            glm::vec3 offset;
+            do {
+                offset = glm::vec3(utils::random(), utils::random(), utils::random()) * 2.0f - 1.0f;
+            } while (glm::dot(offset, offset) >= 1.0f);
+            bounce.push_back({ pt, glm::normalize(normal + offset) });
+        }
+    }
+    return bounce;
+}
+
+// the traversal the shader used before the closest hit one: collect the
+// objects of every leaf the ray reaches, then intersect them
+struct CollectScratch
+{
+    std::vector<int> candidates;
+    std::vector<int> stack;
+};
+
+int collectThenIntersect(const bvh_tree& tree, const std::vector<SphereObject>& spheres, const ray& r,
+                         float tmin, float& tmax, CollectScratch& scratch, traversal_stats& stats,
+                         int& numCandidates, int& stackSize)
+{
+    const auto& nodes = tree.nodes();
+    glm::vec3 invDir = 1.0f / r.dir;
+    auto& candidates = scratch.candidates;
+    auto& stack = scratch.stack;
+    candidates.clear();
+    stack.assign(1, 0);
+    stackSize = 1;
+    while (!stack.empty()) {
+        const auto& node = nodes[stack.back()];
+        stack.pop_back();
+        ++stats.nodes;
+        float tnear;
+        if (!intersect(r, invDir, node.volume, tmin, tmax, tnear)) {
+            continue;
+        }
+        if (node.is_leaf()) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                candidates.push_back(tree.indices()[i]);
+            }
+        } else {
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+            stackSize = std::max(stackSize, (int)stack.size());
+        }
+    }
+
+    int hit = -1;
+    for (int i : candidates) {
+        float t = spheres[i].hit(r, tmin, tmax);
+        if (t >= 0) {
+            tmax = t;
+            hit = i;
+        }
+    }
+    stats.objects += candidates.size();
+    numCandidates = (int)candidates.size();
+    return hit;
+}
+
+// the stackless traversal of the shader over the nodes laid out with skip links
+int skipLinkClosestHit(const std::vector<Node>& nodes, const std::vector<int>& indices,
+                       const std::vector<SphereObject>& spheres, const ray& r, float tmin, float& tmax,
+                       traversal_stats& stats)
+{
+    glm::vec3 invDir = 1.0f / r.dir;
+    int hit = -1;
+    int node = 0;
+    while (node != -1) {
+        const auto& current = nodes[node];
+        ++stats.nodes;
+        float tnear;
+        if (!intersect(r, invDir, aabb3(current.min, current.max), tmin, tmax, tnear)) {
+            node = current.right;
+        } else if (current.left == -1) {
+            for (int i = current.firstObjIndex; i < current.firstObjIndex + current.numObj; ++i) {
+                float t = spheres[indices[i]].hit(r, tmin, tmax);
+                if (t >= 0) {
+                    tmax = t;
+                    hit = indices[i];
+                }
+            }
+            stats.objects += current.numObj;
+            node = current.right;
+        } else {
+            node = current.left;
+        }
+    }
+    return hit;
+}
+
+void benchmarkBvhTraversal()
+{
+    // the limits of the candidate list and the stack of the old shader
+    const int MaxCandidates = 64;
+    const int MaxStack = 32;
+
+    std::printf("%12s %9s %10s %12s %12s %10s %10s %10s\n", "spheres", "rays", "traversal", "nodes / ray",
+                "tests / ray", "Mrays/s", "overflows", "mismatches");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        auto scene = createScene(gridSize);
+        const auto& spheres = scene.objects;
+        const auto& tree = *scene.bvh;
+
+        // the primary rays, and one diffuse bounce off each of their hits
+        auto primary = cameraRays(400, 300);
+        auto bounce = bounceRays(tree, spheres, primary);
+        SceneBuffer skipLinks(scene, 2, false, true);
+
+        const struct {
+            const char* name;
+            const std::vector<ray>* rays;
+        } batches[] = { { "primary", &primary }, { "bounce", &bounce } };
+        for (const auto& batch : batches) {
+            const auto& rays = *batch.rays;
+            std::vector<int> hits(rays.size());
+
+            traversal_stats before;
+            CollectScratch scratch;
+            int overflows = 0;
+            double ms = measure(1, [&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    float tmax = FLT_MAX;
+                    int numCandidates, stackSize;
+                    hits[i] = collectThenIntersect(tree, spheres, rays[i], 0.0001f, tmax, scratch, before,
+                                                   numCandidates, stackSize);
+                    if (numCandidates > MaxCandidates || stackSize > MaxStack) {
+                        ++overflows;
+                    }
+                }
+            });
+            std::printf("%12zu %9s %10s %12.1f %12.2f %10.2f %10d %10s\n", spheres.size(), batch.name, "collect",
+                        (double)before.nodes / rays.size(), (double)before.objects / rays.size(),
+                        rays.size() / ms / 1000, overflows, "-");
+
+            traversal_stats after;
+            int mismatches = 0;
+            ms = measure(1, [&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    const auto& r = rays[i];
+                    float tmax = FLT_MAX;
+                    int hit = tree.closest_hit(r, 0.0001f, tmax, [&](int i, float tmin, float tmax) {
+                        return spheres[i].hit(r, tmin, tmax);
+                    }, &after);
+                    if (hit != hits[i]) {
+                        ++mismatches;
+                    }
+                }
+            });
+            std::printf("%12zu %9s %10s %12.1f %12.2f %10.2f %10s %10d\n", spheres.size(), batch.name, "closest",
+                        (double)after.nodes / rays.size(), (double)after.objects / rays.size(),
+                        rays.size() / ms / 1000, "-", mismatches);
+
+            traversal_stats skip;
+            mismatches = 0;
+            ms = measure(1, [&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    float tmax = FLT_MAX;
+                    int hit = skipLinkClosestHit(skipLinks.nodes, tree.indices(), spheres, rays[i], 0.0001f, tmax,
+                                                 skip);
+                    if (hit != hits[i]) {
+                        ++mismatches;
+                    }
+                }
+            });
+            std::printf("%12zu %9s %10s %12.1f %12.2f %10.2f %10s %10d\n", spheres.size(), batch.name, "skip",
+                        (double)skip.nodes / rays.size(), (double)skip.objects / rays.size(),
+                        rays.size() / ms / 1000, "-", mismatches);
+        }
+    }
+}
+
+void benchmarkBvhOcclusion()
+{
+    // the ray length of the ambient occlusion integrator
+    const float AODistance = 2.0f;
+
+    std::printf("%12s %10s %9s %10s %12s %14s %12s %10s %10s\n", "spheres", "length", "blocked", "query",
+                "nodes / ray", "nodes / block", "tests / ray", "Mrays/s", "mismatches");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        auto scene = createScene(gridSize);
+        const auto& spheres = scene.objects;
+        const auto& tree = *scene.bvh;
+        // the occlusion rays start on the surfaces like the ones of the integrator
+        auto rays = bounceRays(tree, spheres, cameraRays(400, 300));
+
+        for (float length : { AODistance, FLT_MAX }) {
+            std::vector<char> blocked(rays.size());
+            int numBlocked = 0;
+            for (bool anyHit : { false, true }) {
+                // the stats of all the rays and of the blocked ones only
+                traversal_stats all, hits;
+                int mismatches = 0;
+                double ms = measure(1, [&] {
+                    for (size_t i = 0; i < rays.size(); ++i) {
+                        const auto& r = rays[i];
+                        auto intersect = [&](int i, float tmin, float tmax) {
+                            return spheres[i].hit(r, tmin, tmax);
+                        };
+                        traversal_stats stats;
+                        float tmax = length;
+                        bool occluded = anyHit ? tree.occluded(r, 0.0001f, tmax, intersect, &stats)
+                                               : tree.closest_hit(r, 0.0001f, tmax, intersect, &stats) != -1;
+                        if (!anyHit) {
+                            blocked[i] = occluded;
+                            numBlocked += occluded;
+                        } else if (occluded != (bool)blocked[i]) {
+                            ++mismatches;
+                        }
+                        all.nodes += stats.nodes;
+                        all.objects += stats.objects;
+                        if (occluded) {
+                            hits.nodes += stats.nodes;
+                        }
+                    }
+                });
+                std::printf("%12zu %10g %8.1f%% %10s %12.1f %14.1f %12.2f %10.2f %10d\n", spheres.size(), length,
+                            100.0 * numBlocked / rays.size(), anyHit ? "occluded" : "closest",
+                            (double)all.nodes / rays.size(), (double)hits.nodes / std::max(numBlocked, 1),
+                            (double)all.objects / rays.size(), rays.size() / ms / 1000, mismatches);
+            }
+        }
+    }
+}
+
+void benchmarkBvhPackets()
+{
+    const int Width = 400;
+    const int Height = 300;
+
+    std::printf("%12s %8s %8s %12s %10s %10s\n", "spheres", "isa", "packet", "nodes / ray", "Mrays/s",
+                "mismatches");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        auto scene = createScene(gridSize);
+        const auto& spheres = scene.objects;
+        const auto& tree = *scene.bvh;
+        auto camera = defaultCamera();
+        glm::vec2 size(Width, Height);
+
+        // the results of the scalar traversal per pixel
+        std::vector<float> scalarT;
+        std::vector<int> scalarHits;
+        for (auto isa : { simd_isa::scalar, simd_isa::sse, simd_isa::avx2, simd_isa::avx512 }) {
+            if (!simd_isa_supported(isa)) {
+                std::printf("%12zu %8s %8s\n", spheres.size(), simd_isa_name(isa), "-");
+                continue;
+            }
+
+            // the rays of the pixel blocks one packet after the other
+            int packetWidth = packet_width(isa);
+            int packetHeight = packet_size(isa) / packetWidth;
+            std::vector<ray> rays;
+            std::vector<int> pixels;
+            for (int by = 0; by < Height; by += packetHeight) {
+                for (int bx = 0; bx < Width; bx += packetWidth) {
+                    for (int y = by; y < by + packetHeight; ++y) {
+                        for (int x = bx; x < bx + packetWidth; ++x) {
+                            rays.push_back(camera.getRay(glm::vec2(x + 0.5f, y + 0.5f), size));
+                            pixels.push_back(y * Width + x);
+                        }
+                    }
+                }
+            }
+
+            std::vector<float> t(rays.size());
+            std::vector<int> hits(rays.size());
+            traversal_stats stats;
+            double ms = measure(3, [&] {
+                stats = traversal_stats();
+                int n = packet_size(isa);
+                for (size_t i = 0; i < rays.size(); i += n) {
+                    std::fill(&t[i], &t[i] + n, FLT_MAX);
+                    closest_hit_packet(isa, tree, spheres.data(), &rays[i], n, 0.0001f, &t[i], &hits[i], &stats);
+                }
+            });
+
+            int mismatches = 0;
+            if (isa == simd_isa::scalar) {
+                scalarT.resize(rays.size());
+                scalarHits.resize(rays.size());
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    scalarT[pixels[i]] = t[i];
+                    scalarHits[pixels[i]] = hits[i];
+                }
+            } else {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    if (hits[i] != scalarHits[pixels[i]] ||
+                        std::memcmp(&t[i], &scalarT[pixels[i]], sizeof(float)) != 0) {
+                        ++mismatches;
+                    }
+                }
+            }
+            std::printf("%12zu %8s %6dx%d %12.1f %10.2f %10d\n", spheres.size(), simd_isa_name(isa),
+                        packetWidth, packetHeight, (double)stats.nodes / rays.size(),
+                        rays.size() / ms / 1000, mismatches);
+        }
+    }
+}
+
+// packets lose their coherence after the first bounce, compare them with the
+// single ray traversal of the wide trees per bounce depth
+void benchmarkBvhBounces()
+{
+    const int MaxDepth = 4;
+    // the camera rays of 4x4 pixel blocks one after the other, so that the
+    // packets of every instruction set start out coherent
+    const int Width = 400;
+    const int Height = 300;
+    const int BlockSize = 4;
+
+    std::printf("%12s %6s %8s %12s %12s %10s %10s\n", "spheres", "depth", "rays", "traversal", "nodes / ray",
+                "Mrays/s", "mismatches");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        auto scene = createScene(gridSize);
+        const auto& spheres = scene.objects;
+        const auto& tree = *scene.bvh;
+        auto packetIsa = best_simd_isa();
+        auto camera = defaultCamera();
+        glm::vec2 size(Width, Height);
+
+        std::vector<ray> rays;
+        for (int by = 0; by < Height; by += BlockSize) {
+            for (int bx = 0; bx < Width; bx += BlockSize) {
+                for (int y = by; y < by + BlockSize; ++y) {
+                    for (int x = bx; x < bx + BlockSize; ++x) {
+                        rays.push_back(camera.getRay(glm::vec2(x + 0.5f, y + 0.5f), size));
+                    }
+                }
+            }
+        }
+
+        for (int depth = 0; depth <= MaxDepth && !rays.empty(); ++depth) {
+            std::vector<float> scalarT(rays.size());
+            std::vector<int> scalarHits(rays.size());
+            auto report = [&](const std::string& name, const std::function<void(float*, int*, traversal_stats*)>& trace) {
+                std::vector<float> t(rays.size());
+                std::vector<int> hits(rays.size());
+                traversal_stats stats;
+                double ms = measure(3, [&] {
+                    stats = traversal_stats();
+                    std::fill(t.begin(), t.end(), FLT_MAX);
+                    trace(t.data(), hits.data(), &stats);
+                });
+
+                int mismatches = 0;
+                if (name == "scalar") {
+                    scalarT = t;
+                    scalarHits = hits;
+                } else {
+                    for (size_t i = 0; i < rays.size(); ++i) {
+                        if (hits[i] != scalarHits[i] || std::memcmp(&t[i], &scalarT[i], sizeof(float)) != 0) {
+                            ++mismatches;
+                        }
+                    }
+                }
+                std::printf("%12zu %6d %8zu %12s %12.1f %10.2f %10d\n", spheres.size(), depth, rays.size(),
+                            name.c_str(), (double)stats.nodes / rays.size(), rays.size() / ms / 1000, mismatches);
+            };
+
+            report("scalar", [&](float* t, int* hits, traversal_stats* stats) {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    const auto& r = rays[i];
+                    hits[i] = tree.closest_hit(r, 0.0001f, t[i], [&](int k, float tmin, float tmax) {
+                        return spheres[k].hit(r, tmin, tmax);
+                    }, stats);
+                }
+            });
+            if (packetIsa != simd_isa::scalar) {
+                report(std::string("packet-") + simd_isa_name(packetIsa), [&](float* t, int* hits, traversal_stats* stats) {
+                    int n = packet_size(packetIsa);
+                    for (size_t i = 0; i < rays.size(); i += n) {
+                        int count = (int)std::min<size_t>(n, rays.size() - i);
+                        closest_hit_packet(packetIsa, tree, spheres.data(), &rays[i], count, 0.0001f, &t[i], &hits[i], stats);
+                    }
+                });
+            }
+            for (auto isa : { simd_isa::sse, simd_isa::avx2, simd_isa::avx512 }) {
+                if (!simd_isa_supported(isa)) {
+                    continue;
+                }
+                wide_traversal wide(tree, spheres, isa);
+                if (wide.isa() == simd_isa::scalar) {
+                    continue;
+                }
+                report(std::string("wide-") + simd_isa_name(isa), [&](float* t, int* hits, traversal_stats* stats) {
+                    for (size_t i = 0; i < rays.size(); ++i) {
+                        hits[i] = wide.closest_hit(rays[i], 0.0001f, t[i], stats);
+                    }
+                });
+            }
+            rays = bounceRays(tree, spheres, rays);
+        }
+    }
+}
+
+// sweep the leaf size per instruction set with the rays of one sample of
+// the cpu renderer: the primary rays as packets and their first bounces
+// with the wide traversal
+void benchmarkBvhLeaves()
+{
+    const int Width = 400;
+    const int Height = 300;
+    const int BlockSize = 4;
+
+    auto& pool = thread_pool::instance();
+    std::printf("%12s %8s %6s %10s %10s %10s %10s\n", "spheres", "isa", "leaf", "nodes", "primary", "bounce",
+                "Mrays/s");
+    for (int gridSize : { DefaultGridSize, gridSizeFor(1000000) }) {
+        auto spheres = createSpheres(gridSize);
+        auto objects = toObjects(spheres);
+        auto camera = defaultCamera();
+        glm::vec2 size(Width, Height);
+
+        std::vector<ray> primary;
+        for (int by = 0; by < Height; by += BlockSize) {
+            for (int bx = 0; bx < Width; bx += BlockSize) {
+                for (int y = by; y < by + BlockSize; ++y) {
+                    for (int x = bx; x < bx + BlockSize; ++x) {
+                        primary.push_back(camera.getRay(glm::vec2(x + 0.5f, y + 0.5f), size));
+                    }
+                }
+            }
+        }
+        std::vector<ray> bounce;
+
+        for (auto isa : { simd_isa::scalar, simd_isa::sse, simd_isa::avx2, simd_isa::avx512 }) {
+            if (!simd_isa_supported(isa)) {
+                continue;
+            }
+            int bestLeafSize = 0;
+            double bestRate = 0;
+            for (int leafSize : { 1, 2, 4, 8, 12, 16 }) {
+                bvh_tree tree(objects.data(), objects.size(), &pool, bvh_builder::sah, leafSize);
+                if (bounce.empty()) {
+                    // the same bounces for every tree
+                    bounce = bounceRays(tree, spheres, primary);
+                }
+                wide_traversal wide(tree, spheres, isa);
+
+                std::vector<float> t(std::max(primary.size(), bounce.size()));
+                std::vector<int> hits(t.size());
+                double primaryMs = measure(3, [&] {
+                    int n = packet_size(isa);
+                    for (size_t i = 0; i < primary.size(); i += n) {
+                        std::fill(&t[i], &t[i] + n, FLT_MAX);
+                        closest_hit_packet(isa, tree, spheres.data(), &primary[i], n, 0.0001f, &t[i], &hits[i]);
+                    }
+                });
+                double bounceMs = measure(3, [&] {
+                    for (size_t i = 0; i < bounce.size(); ++i) {
+                        t[i] = FLT_MAX;
+                        hits[i] = wide.closest_hit(bounce[i], 0.0001f, t[i]);
+                    }
+                });
+
+                double rate = (primary.size() + bounce.size()) / (primaryMs + bounceMs) / 1000;
+                if (rate > bestRate) {
+                    bestRate = rate;
+                    bestLeafSize = leafSize;
+                }
+                std::printf("%12zu %8s %6d %10zu %10.2f %10.2f %10.2f\n", spheres.size(), simd_isa_name(isa),
+                            leafSize, tree.nodes().size(), primary.size() / primaryMs / 1000,
+                            bounce.size() / bounceMs / 1000, rate);
+            }
+            std::printf("%12zu %8s %6d best\n", spheres.size(), simd_isa_name(isa), bestLeafSize);
+        }
+    }
+}
+
+} // anonymous namespace
+
+bool runBenchmark(const std::string& name)
+{
+    if (name == "bvh") {
+        benchmarkBvhBuild();
+    } else if (name == "bvh-scaling") {
+        benchmarkBvhScaling();
+    } else if (name == "bvh-builders") {
+        benchmarkBvhBuilders();
+    } else if (name == "bvh-memory") {
+        benchmarkBvhMemory();
+    } else if (name == "bvh-nodes") {
+        benchmarkBvhNodes();
+    } else if (name == "bvh-traversal") {
+        benchmarkBvhTraversal();
+    } else if (name == "bvh-occlusion") {
+        benchmarkBvhOcclusion();
+    } else if (name == "bvh-packets") {
+        benchmarkBvhPackets();
+    } else if (name == "bvh-bounces") {
+        benchmarkBvhBounces();
+    } else if (name == "bvh-leaves") {
+        benchmarkBvhLeaves();
+    } else {
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
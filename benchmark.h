@@ -0,0 +1,12 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#pragma once
+
+#include <string>
+
+// run the named cpu benchmark and print the results
+// return false if the benchmark is unknown
+bool runBenchmark(const std::string& name);
+
+#endif // BENCHMARK_H
\ No newline at end of file
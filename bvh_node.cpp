@@ -1,92 +1,635 @@
 #include "bvh_node.h"
 #include "object.h"
-#include "utils.h"
+#include "thread_pool.h"
 
-#include <iterator>
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <limits>
-#include <numeric>
 
 using namespace std;
 
-bvh_node::bvh_node(object** objs, int n)
+struct bvh_tree::build_prim
 {
-    // find the aabb of the current node
-    m_volume = accumulate(objs, objs + n, aabb3::empty(),
-                          [](const auto& a, auto b) { return a.expand(b->get_aabb()); });
+    aabb3 volume;
+    glm::vec3 centroid;
+    int index;
+};
 
-    if (n <= max_objects) {
-        m_objects.assign(objs, objs + n);
+// the nodes of a subtree built by one task in depth first order
+// a child built by another task is referenced as link(i), i being its index
+// in children, until the blocks are copied into the final array. The final
+// array is in depth first order too, a child block is placed right after the
+// node that links to it
+struct bvh_tree::node_block
+{
+    vector<bvh_node> nodes;
+    vector<unique_ptr<node_block>> children;
+    // the nodes of this block that come before this child block in the final
+    // array, the children are ordered by it
+    int insert_at = 0;
+    // the nodes of the subtree of the block, with its child blocks
+    int size = 0;
+    // the index of the first node in the final array
+    int base = 0;
+
+    static int link(int i) { return -2 - i; }
+    static int child(int link) { return -2 - link; }
+};
+
+namespace
+{
+
+struct bin
+{
+    aabb3 volume;
+    int count;
+};
+
+template<typename Code>
+struct morton_traits;
+
+template<>
+struct morton_traits<uint32_t>
+{
+    static constexpr int axis_bits = 10;
+    static constexpr int code_bits = 30;
+};
+
+template<>
+struct morton_traits<uint64_t>
+{
+    static constexpr int axis_bits = 21;
+    static constexpr int code_bits = 63;
+};
+
+// insert two zero bits after each of the lower 10 bits
+uint32_t expand_bits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// insert two zero bits after each of the lower 21 bits
+uint64_t expand_bits(uint64_t v)
+{
+    v &= 0x1FFFFF;
+    v = (v | v << 32) & 0x001F00000000FFFFull;
+    v = (v | v << 16) & 0x001F0000FF0000FFull;
+    v = (v | v << 8) & 0x100F00F00F00F00Full;
+    v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+template<typename Code>
+Code morton_encode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return expand_bits(Code(x)) << 2 | expand_bits(Code(y)) << 1 | expand_bits(Code(z));
+}
+
+template<typename Code>
+int highest_bit(Code v)
+{
+    int bit = 0;
+    while (v >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+template<typename Code>
+struct morton_key
+{
+    Code code;
+    int index;
+};
+
+// sort the keys by their lower bits with a stable LSD radix sort of 8 bits per pass,
+// every pass builds per chunk histograms and scatters the chunks in parallel
+template<typename Code>
+void radix_sort(vector<morton_key<Code>>& keys, int bits, thread_pool* pool)
+{
+    constexpr int radix = 256;
+    constexpr int chunk_size = 1 << 14;
+    int n = (int)keys.size();
+    int num_chunks = (n + chunk_size - 1) / chunk_size;
+
+    vector<morton_key<Code>> sorted(n);
+    vector<array<int, radix>> offsets(num_chunks);
+    for (int shift = 0; shift < bits; shift += 8) {
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            auto& histogram = offsets[begin / chunk_size];
+            histogram.fill(0);
+            for (int i = begin; i < end; ++i) {
+                ++histogram[(keys[i].code >> shift) & (radix - 1)];
+            }
+        });
+
+        // the keys of a digit are placed in the order of the chunks
+        int sum = 0;
+        for (int digit = 0; digit < radix; ++digit) {
+            for (auto& histogram : offsets) {
+                int count = histogram[digit];
+                histogram[digit] = sum;
+                sum += count;
+            }
+        }
+
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            auto& offset = offsets[begin / chunk_size];
+            for (int i = begin; i < end; ++i) {
+                sorted[offset[(keys[i].code >> shift) & (radix - 1)]++] = keys[i];
+            }
+        });
+        keys.swap(sorted);
+    }
+}
+
+} // anonymous namespace
+
+bvh_tree::bvh_tree(object** objs, int n, thread_pool* pool, bvh_builder builder, int max_leaf_size)
+    : m_max_leaf_size(max(max_leaf_size, 1))
+{
+    // query the bounds of the objects only once
+    vector<build_prim> prims(n);
+    parallel_for(pool, 0, n, bin_chunk_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            prims[i].volume = objs[i]->get_aabb();
+            prims[i].centroid = prims[i].volume.center();
+            prims[i].index = i;
+        }
+    });
+
+    node_block root;
+    // a subtree has at most 2n - 1 nodes
+    root.nodes.reserve(max(1, min(n, parallel_build_threshold) * 2 - 1));
+    if (builder == bvh_builder::sah || n <= m_max_leaf_size) {
+        build_sah(root, prims.data(), 0, n, pool);
+    } else if (n <= morton30_max_objects) {
+        build_lbvh<uint32_t>(root, prims, builder, pool);
     } else {
-        // use SAH to build the BVH
-        float min_cost = numeric_limits<float>::max();
-        vector<object*> permutation(n);
-        int left_obj_num;
-
-        vector<float> left_areas(n);
-        vector<float> right_areas(n);
-
-        // for each axis
-        for (int i = 0; i < 3; ++i) {
-            sort(objs, objs + n, [=](auto const& lhs, auto rhs) {
-                    return lhs->get_aabb().center()[i] < rhs->get_aabb().center()[i];
-                 });
-
-            // calculate the area for all possible partitions
-            auto bb = aabb3::empty();
-            transform(objs, objs + n, left_areas.begin(), [&](auto p) {
-                        bb.expand(p->get_aabb());
-                        return bb.area();
-                      });
-
-            bb = aabb3::empty();
-            transform(make_reverse_iterator(objs + n), make_reverse_iterator(objs),
-                      right_areas.begin(), [&](auto p) {
-                        bb.expand(p->get_aabb());
-                        return bb.area();
-                      });
-
-            bool need_update = false;
-            auto start = objs;
-            float step = (m_volume.max[i] - m_volume.min[i]) / bin_num;
-            for (int j = 1; j < bin_num && start != objs + n; ++j) {
-                auto it = find_if(start, objs + n, [=](auto p) {
-                                        return p->get_aabb().center()[i] >= j * step;
-                                    });
-                float cost = 0.0f;
-                auto left_num = it - objs;
-                if (left_num > 0) {
-                    cost += left_areas[left_num - 1] * left_num;
-                }
-                auto right_num = n - left_num;
-                if (right_num > 0) {
-                    cost += right_areas[right_num - 1] * right_num;
-                }
-                if (cost < min_cost) {
-                    min_cost = cost;
-                    left_obj_num = left_num;
-                    need_update = true;
+        build_lbvh<uint64_t>(root, prims, builder, pool);
+    }
+
+    m_indices.resize(n);
+    parallel_for(pool, 0, n, bin_chunk_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            m_indices[i] = prims[i].index;
+        }
+    });
+
+    if (root.children.empty()) {
+        m_nodes = move(root.nodes);
+    } else {
+        int size = 0;
+        place_blocks(root, size);
+        m_nodes.resize(size);
+        copy_blocks(root, pool);
+    }
+}
+
+int bvh_tree::build_sah(node_block& block, build_prim* prims, int begin, int n, thread_pool* pool)
+{
+    int index = (int)block.nodes.size();
+    block.nodes.emplace_back();
+    auto& node = block.nodes.back();
+    node.first = begin;
+    node.count = 0;
+    auto range = prims + begin;
+
+    // large nodes are processed in fixed size chunks which are merged in order,
+    // so the result is the same whether the chunks run in parallel or not
+    bool chunked = n >= parallel_bin_threshold;
+    int chunk_size = chunked ? bin_chunk_size : max(n, 1);
+    int num_chunks = (n + chunk_size - 1) / chunk_size;
+
+    // find the aabb of the current node and the bounds of the centroids
+    auto find_bounds = [range](int begin, int end, aabb3& volume, aabb3& centroids) {
+        volume = aabb3::empty();
+        centroids = aabb3::empty();
+        for (int i = begin; i < end; ++i) {
+            volume.expand(range[i].volume);
+            centroids.expand({ range[i].centroid, range[i].centroid });
+        }
+    };
+    aabb3 centroids;
+    if (!chunked) {
+        find_bounds(0, n, node.volume, centroids);
+    } else {
+        vector<aabb3> volumes(num_chunks);
+        vector<aabb3> centroid_volumes(num_chunks);
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            int chunk = begin / chunk_size;
+            find_bounds(begin, end, volumes[chunk], centroid_volumes[chunk]);
+        });
+        node.volume = volumes[0];
+        centroids = centroid_volumes[0];
+        for (int i = 1; i < num_chunks; ++i) {
+            node.volume.expand(volumes[i]);
+            centroids.expand(centroid_volumes[i]);
+        }
+    }
+
+    if (n <= m_max_leaf_size) {
+        node.left = node.right = -1;
+        node.count = n;
+        return index;
+    }
+    // the node may move when the children are added
+    auto volume = node.volume;
+
+    // use binned SAH to build the BVH
+    // bin the centroids along all the axes in one pass
+    // small nodes do not need more bins than objects
+    int num_bins = min(n, bin_num);
+    glm::vec3 extent = centroids.max - centroids.min;
+    glm::vec3 scale;
+    for (int i = 0; i < 3; ++i) {
+        scale[i] = extent[i] > 0 ? num_bins * (1.0f - 1e-6f) / extent[i] : 0.0f;
+    }
+    auto bin_index = [&](const build_prim& p, int axis) {
+        return min(num_bins - 1, (int)((p.centroid[axis] - centroids.min[axis]) * scale[axis]));
+    };
+
+    using bin_set = array<array<bin, bin_num>, 3>;
+    auto fill_bins = [&](int begin, int end, bin_set& bins) {
+        for (int axis = 0; axis < 3; ++axis) {
+            fill_n(bins[axis].begin(), num_bins, bin{ aabb3::empty(), 0 });
+        }
+        for (int i = begin; i < end; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                auto& b = bins[axis][bin_index(range[i], axis)];
+                b.volume.expand(range[i].volume);
+                ++b.count;
+            }
+        }
+    };
+    bin_set bins;
+    if (!chunked) {
+        fill_bins(0, n, bins);
+    } else {
+        for (int axis = 0; axis < 3; ++axis) {
+            fill_n(bins[axis].begin(), num_bins, bin{ aabb3::empty(), 0 });
+        }
+        vector<bin_set> chunk_bins(num_chunks);
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            fill_bins(begin, end, chunk_bins[begin / chunk_size]);
+        });
+        for (const auto& chunk : chunk_bins) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int j = 0; j < num_bins; ++j) {
+                    bins[axis][j].volume.expand(chunk[axis][j].volume);
+                    bins[axis][j].count += chunk[axis][j].count;
                 }
+            }
+        }
+    }
+
+    // sweep the bins from both ends to evaluate the cost of every split plane
+    float min_cost = numeric_limits<float>::max();
+    int split_axis = -1;
+    int split_bin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0) {
+            continue;
+        }
 
-                start = it;
+        float right_costs[bin_num];
+        auto bb = aabb3::empty();
+        int count = 0;
+        for (int j = num_bins - 1; j > 0; --j) {
+            bb.expand(bins[axis][j].volume);
+            count += bins[axis][j].count;
+            right_costs[j] = count ? bb.surface_area() * count : 0.0f;
+        }
+
+        bb = aabb3::empty();
+        count = 0;
+        for (int j = 0; j < num_bins - 1; ++j) {
+            bb.expand(bins[axis][j].volume);
+            count += bins[axis][j].count;
+            if (count == 0 || count == n) {
+                continue;
+            }
+            float cost = bb.surface_area() * count + right_costs[j + 1];
+            if (cost < min_cost) {
+                min_cost = cost;
+                split_axis = axis;
+                split_bin = j;
             }
+        }
+    }
+
+    int left_num;
+    if (split_axis == -1) {
+        // all the centroids fall into one bin, split at the median of the longest axis
+        int axis = 0;
+        for (int i = 1; i < 3; ++i) {
+            if (extent[i] > extent[axis]) {
+                axis = i;
+            }
+        }
+        left_num = n / 2;
+        nth_element(range, range + left_num, range + n, [axis](const auto& lhs, const auto& rhs) {
+                        return lhs.centroid[axis] < rhs.centroid[axis];
+                    });
+    } else if (!chunked) {
+        auto mid = partition(range, range + n, [&](const auto& p) {
+                                 return bin_index(p, split_axis) <= split_bin;
+                             });
+        left_num = mid - range;
+    } else {
+        // stable partition: count the left objects of every chunk, then
+        // scatter the chunks to their final places
+        auto goes_left = [&](const build_prim& p) { return bin_index(p, split_axis) <= split_bin; };
+        vector<int> left_counts(num_chunks);
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            left_counts[begin / chunk_size] = count_if(range + begin, range + end, goes_left);
+        });
+
+        vector<int> left_offsets(num_chunks);
+        left_num = 0;
+        for (int i = 0; i < num_chunks; ++i) {
+            left_offsets[i] = left_num;
+            left_num += left_counts[i];
+        }
+
+        vector<build_prim> sorted(n);
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            int left = left_offsets[begin / chunk_size];
+            int right = left_num + begin - left;
+            for (int i = begin; i < end; ++i) {
+                sorted[goes_left(range[i]) ? left++ : right++] = range[i];
+            }
+        });
+        parallel_for(pool, 0, n, chunk_size, [&](int begin, int end) {
+            copy(sorted.begin() + begin, sorted.begin() + end, range + begin);
+        });
+    }
+
+    auto [left, right] = build_children(block, begin, n, left_num, pool,
+        [&](node_block& b, int first, int count) { return build_sah(b, prims, first, count, pool); });
+
+    block.nodes[index] = { volume, left, right, begin, 0 };
+    return index;
+}
+
+template<typename Code>
+void bvh_tree::build_lbvh(node_block& root, vector<build_prim>& prims, bvh_builder builder, thread_pool* pool)
+{
+    int n = (int)prims.size();
+    int num_chunks = (n + bin_chunk_size - 1) / bin_chunk_size;
+
+    // quantize the centroids to the grid of the morton curve
+    vector<aabb3> chunk_centroids(num_chunks);
+    parallel_for(pool, 0, n, bin_chunk_size, [&](int begin, int end) {
+        auto& centroids = chunk_centroids[begin / bin_chunk_size];
+        centroids = aabb3::empty();
+        for (int i = begin; i < end; ++i) {
+            centroids.expand({ prims[i].centroid, prims[i].centroid });
+        }
+    });
+    auto centroids = aabb3::empty();
+    for (const auto& c : chunk_centroids) {
+        centroids.expand(c);
+    }
+
+    constexpr int axis_bits = morton_traits<Code>::axis_bits;
+    constexpr float cells = (float)((1u << axis_bits) - 1);
+    glm::vec3 extent = centroids.max - centroids.min;
+    glm::vec3 scale;
+    for (int i = 0; i < 3; ++i) {
+        scale[i] = extent[i] > 0 ? cells / extent[i] : 0.0f;
+    }
+
+    vector<morton_key<Code>> keys(n);
+    parallel_for(pool, 0, n, bin_chunk_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            glm::vec3 p = glm::min((prims[i].centroid - centroids.min) * scale, glm::vec3(cells));
+            keys[i].code = morton_encode<Code>((uint32_t)p.x, (uint32_t)p.y, (uint32_t)p.z);
+            keys[i].index = i;
+        }
+    });
+    radix_sort(keys, morton_traits<Code>::code_bits, pool);
+
+    // reorder the objects along the curve
+    vector<build_prim> sorted(n);
+    vector<Code> codes(n);
+    parallel_for(pool, 0, n, bin_chunk_size, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            sorted[i] = prims[keys[i].index];
+            codes[i] = keys[i].code;
+        }
+    });
+    prims.swap(sorted);
+
+    emit_lbvh(root, prims.data(), codes.data(), 0, n, builder, pool);
+}
+
+template<typename Code>
+int bvh_tree::emit_lbvh(node_block& block, build_prim* prims, const Code* codes, int begin, int n,
+                        bvh_builder builder, thread_pool* pool)
+{
+    if (builder == bvh_builder::hybrid && n <= treelet_size) {
+        // the treelets are small enough to afford the SAH
+        return build_sah(block, prims, begin, n, pool);
+    }
+
+    int index = (int)block.nodes.size();
+    block.nodes.emplace_back();
+    if (n <= m_max_leaf_size) {
+        auto volume = aabb3::empty();
+        for (int i = begin; i < begin + n; ++i) {
+            volume.expand(prims[i].volume);
+        }
+        block.nodes[index] = { volume, -1, -1, begin, n };
+        return index;
+    }
 
-            if (need_update) {
-                copy(objs, objs + n, permutation.begin());
+    // split where the highest bit that differs in the range changes, the
+    // objects of a cell sharing the same code are split in halves
+    Code first = codes[begin];
+    Code last = codes[begin + n - 1];
+    int left_num = n / 2;
+    if (first != last) {
+        Code mask = Code(1) << highest_bit(first ^ last);
+        left_num = (int)(partition_point(codes + begin, codes + begin + n,
+                                         [mask](Code c) { return !(c & mask); }) - (codes + begin));
+    }
+
+    auto [left, right] = build_children(block, begin, n, left_num, pool,
+        [&](node_block& b, int first, int count) {
+            return emit_lbvh(b, prims, codes, first, count, builder, pool);
+        });
+
+    auto volume = node_volume(block, left).expand(node_volume(block, right));
+    block.nodes[index] = { volume, left, right, begin, 0 };
+    return index;
+}
+
+template<typename F>
+pair<int, int> bvh_tree::build_children(node_block& block, int begin, int n, int left_num,
+                                        thread_pool* pool, const F& build_child)
+{
+    if (n < parallel_build_threshold) {
+        int left = build_child(block, begin, left_num);
+        int right = build_child(block, begin + left_num, n - left_num);
+        return { left, right };
+    }
+
+    // build the left subtree into its own block on another task, it follows
+    // the node being built, and the right subtree follows it
+    block.children.push_back(make_unique<node_block>());
+    auto& child = *block.children.back();
+    child.insert_at = (int)block.nodes.size();
+    int left = node_block::link((int)block.children.size() - 1);
+
+    task_group group(pool);
+    group.run([&] {
+        child.nodes.reserve(min(left_num, parallel_build_threshold) * 2 - 1);
+        build_child(child, begin, left_num);
+    });
+    int right = build_child(block, begin + left_num, n - left_num);
+    group.wait();
+    return { left, right };
+}
+
+const aabb3& bvh_tree::node_volume(const node_block& block, int i)
+{
+    if (i >= 0) {
+        return block.nodes[i].volume;
+    }
+    // the subtree root is the first node of its block
+    return block.children[node_block::child(i)]->nodes[0].volume;
+}
+
+void bvh_tree::place_blocks(node_block& block, int& offset)
+{
+    // the child blocks are spliced into the nodes of the block where they link
+    int start = offset;
+    block.base = offset;
+    int placed = 0;
+    for (auto& child : block.children) {
+        offset += child->insert_at - placed;
+        placed = child->insert_at;
+        place_blocks(*child, offset);
+    }
+    offset += (int)block.nodes.size() - placed;
+    block.size = offset - start;
+}
+
+void bvh_tree::copy_blocks(const node_block& block, thread_pool* pool)
+{
+    task_group group(pool);
+    for (const auto& child : block.children) {
+        group.run([&] { copy_blocks(*child, pool); });
+    }
+
+    // a node is moved back by the child blocks placed before it
+    vector<int> insert_at(block.children.size());
+    vector<int> shifts(block.children.size() + 1, 0);
+    for (size_t c = 0; c < block.children.size(); ++c) {
+        insert_at[c] = block.children[c]->insert_at;
+        shifts[c + 1] = shifts[c] + block.children[c]->size;
+    }
+    auto position = [&](int i) {
+        auto before = upper_bound(insert_at.begin(), insert_at.end(), i) - insert_at.begin();
+        return block.base + i + shifts[before];
+    };
+    auto resolve = [&](int i) {
+        if (i >= 0) {
+            return position(i);
+        }
+        return i == -1 ? -1 : block.children[node_block::child(i)]->base;
+    };
+    size_t before = 0;
+    for (int i = 0; i < (int)block.nodes.size(); ++i) {
+        while (before < insert_at.size() && insert_at[before] == i) {
+            ++before;
+        }
+        auto& dst = m_nodes[block.base + i + shifts[before]];
+        dst = block.nodes[i];
+        dst.left = resolve(dst.left);
+        dst.right = resolve(dst.right);
+    }
+    group.wait();
+}
+
+template<int W>
+wide_bvh_tree<W>::wide_bvh_tree(const bvh_tree& tree)
+{
+    // every collapse removes at least one node
+    m_nodes.reserve(tree.nodes().size() / 2 + 1);
+    collapse(tree, 0);
+}
+
+template<int W>
+int wide_bvh_tree<W>::collapse(const bvh_tree& tree, int index)
+{
+    const auto& nodes = tree.nodes();
+    int wide_index = (int)m_nodes.size();
+    m_nodes.emplace_back();
+
+    // pull the children of the inner child with the largest surface area
+    // into this node until it is full
+    int slots[W];
+    int num = 0;
+    if (nodes[index].is_leaf()) {
+        slots[num++] = index;
+    } else {
+        slots[num++] = nodes[index].left;
+        slots[num++] = nodes[index].right;
+    }
+    while (num < W) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < num; ++i) {
+            const auto& child = nodes[slots[i]];
+            if (!child.is_leaf() && child.volume.surface_area() > best_area) {
+                best = i;
+                best_area = child.volume.surface_area();
             }
         }
+        if (best == -1) {
+            break;
+        }
+        int inner = slots[best];
+        slots[best] = nodes[inner].left;
+        slots[num++] = nodes[inner].right;
+    }
 
-        if (left_obj_num > 0 && left_obj_num < n) {
-            m_left = make_unique<bvh_node>(permutation.data(), left_obj_num);
-            m_right = make_unique<bvh_node>(permutation.data() + left_obj_num, n - left_obj_num);
-        } else {
-			// fall back to random axis partition
-			auto axis = (int)(2.0f * utils::random() + 1);
-			sort(objs, objs + n, [axis](auto lhs, auto rhs) {
-				return lhs->get_aabb().center()[axis] < rhs->get_aabb().center()[axis];
-			});
-			m_left = make_unique<bvh_node>(objs, n / 2);
-			m_right = make_unique<bvh_node>(objs + n / 2, n - n / 2);
+    wide_bvh_node<W> node;
+    for (int i = 0; i < W; ++i) {
+        aabb3 volume = aabb3::empty();
+        node.child[i] = -1;
+        node.count[i] = 0;
+        if (i < num) {
+            const auto& child = nodes[slots[i]];
+            volume = child.volume;
+            if (child.is_leaf()) {
+                // an empty leaf only exists in an empty tree
+                if (child.count > 0) {
+                    node.child[i] = child.first;
+                    node.count[i] = child.count;
+                }
+            } else {
+                node.child[i] = collapse(tree, slots[i]);
+            }
         }
+        node.min_x[i] = volume.min.x;
+        node.min_y[i] = volume.min.y;
+        node.min_z[i] = volume.min.z;
+        node.max_x[i] = volume.max.x;
+        node.max_y[i] = volume.max.y;
+        node.max_z[i] = volume.max.z;
     }
-}
\ No newline at end of file
+    m_nodes[wide_index] = node;
+    return wide_index;
+}
+
+template class wide_bvh_tree<4>;
+template class wide_bvh_tree<8>;
\ No newline at end of file
@@ -2,46 +2,253 @@
 #define BVH_NODE_H
 
 #include "aabb.h"
+#include "ray.h"
 
 #include <memory>
 #include <vector>
 #include <utility>
 
 class object;
+class thread_pool;
 
-class bvh_node
+// a node of the hierarchy, the children are referenced by their index
+// in bvh_tree::nodes()
+struct bvh_node
+{
+    aabb3 volume;
+    // -1 for leaves
+    int left;
+    int right;
+    // the objects of a leaf are bvh_tree::indices()[first, first + count)
+    int first;
+    int count;
+
+    bool is_leaf() const { return left == -1; }
+};
+
+enum class bvh_builder
+{
+    // binned SAH, best trees
+    sah,
+    // linear BVH from the morton codes of the centroids, fastest to build
+    lbvh,
+    // LBVH for the top levels, SAH for the small subtrees
+    hybrid
+};
+
+// the work done by a traversal, accumulated over the queries it is passed to
+struct traversal_stats
+{
+    long long nodes = 0;
+    long long objects = 0;
+};
+
+// a BVH stored in one contiguous array of nodes with the root at index 0
+class bvh_tree
 {
 public:
-    bvh_node(object** objs, int n);
+    // the leaf size the GPU layouts are built for
+    static constexpr int default_max_leaf_size = 2;
+
+    // build the subtrees in parallel if a pool is given, the resulting tree
+    // does not depend on the number of threads of the pool. Nodes with at
+    // most max_leaf_size objects become leaves
+    bvh_tree(object** objs, int n, thread_pool* pool = nullptr, bvh_builder builder = bvh_builder::sah,
+             int max_leaf_size = default_max_leaf_size);
+
+    const std::vector<bvh_node>& nodes() const { return m_nodes; }
+    const bvh_node& root() const { return m_nodes[0]; }
+    // the indices of the objects referenced by the leaves
+    const std::vector<int>& indices() const { return m_indices; }
+
+    // find the closest object hit by the ray within [tmin, tmax], tmax is
+    // shrunk to the distance of the hit. intersect(object, tmin, tmax)
+    // returns the distance to the object or a negative value if it is missed
+    // return the object index, -1 if nothing is hit
+    template<typename F>
+    int closest_hit(const ray& r, float tmin, float& tmax, const F& intersect,
+                    traversal_stats* stats = nullptr) const
+    {
+        return traverse<false>(r, tmin, tmax, intersect, stats);
+    }
+    // whether any object is hit within [tmin, tmax], the traversal stops at
+    // the first hit instead of looking for the closest one
+    template<typename F>
+    bool occluded(const ray& r, float tmin, float tmax, const F& intersect,
+                  traversal_stats* stats = nullptr) const
+    {
+        return traverse<true>(r, tmin, tmax, intersect, stats) != -1;
+    }
+private:
+    static constexpr int bin_num = 32;
+    // nodes with at least this many objects build their left subtree as a separate task
+    static constexpr int parallel_build_threshold = 4096;
+    // nodes with at least this many objects bin and partition in fixed size chunks
+    static constexpr int parallel_bin_threshold = 1 << 16;
+    static constexpr int bin_chunk_size = 1 << 14;
+    // scenes with more objects use 63 bit morton codes instead of 30 bit ones
+    static constexpr int morton30_max_objects = 1 << 16;
+    // the size of the subtrees the hybrid builder builds with the SAH
+    static constexpr int treelet_size = 256;
+
+    struct build_prim;
+    struct node_block;
+
+    int build_sah(node_block& block, build_prim* prims, int begin, int n, thread_pool* pool);
+    template<typename Code>
+    void build_lbvh(node_block& root, std::vector<build_prim>& prims, bvh_builder builder, thread_pool* pool);
+    template<typename Code>
+    int emit_lbvh(node_block& block, build_prim* prims, const Code* codes, int begin, int n,
+                  bvh_builder builder, thread_pool* pool);
+    template<typename F>
+    std::pair<int, int> build_children(node_block& block, int begin, int n, int left_num,
+                                       thread_pool* pool, const F& build_child);
+    static const aabb3& node_volume(const node_block& block, int i);
+    void place_blocks(node_block& block, int& offset);
+    void copy_blocks(const node_block& block, thread_pool* pool);
 
-    const aabb3& get_aabb() const { return m_volume; }
-    bool is_leaf() const { return !m_left; }
+    template<bool AnyHit, typename F>
+    int traverse(const ray& r, float tmin, float& tmax, const F& intersect, traversal_stats* stats) const;
 
-    const bvh_node* left() const { return m_left.get(); }
-    const bvh_node* right() const { return m_right.get(); }
+    std::vector<bvh_node> m_nodes;
+    std::vector<int> m_indices;
+    int m_max_leaf_size;
+};
 
-    int num_objects() const { return m_objects.size(); }
-    object* get_object(int i) const { return m_objects[i]; }
+// a node with up to W children, the bounds of the children are stored as
+// structure of arrays so that they can be tested against a ray at once
+template<int W>
+struct wide_bvh_node
+{
+    float min_x[W];
+    float min_y[W];
+    float min_z[W];
+    float max_x[W];
+    float max_y[W];
+    float max_z[W];
+    // the node index of an inner child, the first object index of a leaf child,
+    // -1 for an empty slot
+    int child[W];
+    // the number of objects of a leaf child, 0 for inner children and empty slots
+    int count[W];
+};
+
+// a W wide BVH collapsed from a binary one, the object indices are the same
+template<int W>
+class wide_bvh_tree
+{
+public:
+    explicit wide_bvh_tree(const bvh_tree& tree);
+
+    const std::vector<wide_bvh_node<W>>& nodes() const { return m_nodes; }
 private:
-    static constexpr int max_objects = 2;
-    static constexpr int bin_num = 1024;
+    int collapse(const bvh_tree& tree, int index);
+
+    std::vector<wide_bvh_node<W>> m_nodes;
+};
 
-    std::unique_ptr<bvh_node> m_left;
-    std::unique_ptr<bvh_node> m_right;
-    std::vector<object*> m_objects;
+// a stack that keeps the first N entries in place and spills the rest to the heap
+template<typename T, int N>
+class small_stack
+{
+public:
+    bool empty() const { return m_size == 0; }
 
-    aabb3 m_volume;
+    void push(const T& v)
+    {
+        if (m_size < N) {
+            m_local[m_size] = v;
+        } else {
+            m_spill.push_back(v);
+        }
+        ++m_size;
+    }
+
+    T pop()
+    {
+        --m_size;
+        if (m_size < N) {
+            return m_local[m_size];
+        }
+        T v = m_spill.back();
+        m_spill.pop_back();
+        return v;
+    }
+private:
+    T m_local[N];
+    std::vector<T> m_spill;
+    int m_size = 0;
 };
 
-template<typename F>
-void preorder_visit(const bvh_node* root, F&& f)
+template<bool AnyHit, typename F>
+int bvh_tree::traverse(const ray& r, float tmin, float& tmax, const F& intersect,
+                       traversal_stats* stats) const
 {
-    f(root);
-    if (!root) {
-        return;
+    struct entry
+    {
+        int node;
+        float tnear;
+    };
+
+    int hit = -1;
+    if (m_nodes.empty()) {
+        return hit;
     }
-    preorder_visit(root->left(), std::forward<F>(f));
-    preorder_visit(root->right(), std::forward<F>(f));
+    glm::vec3 inv_dir = 1.0f / r.dir;
+    small_stack<entry, 64> stack;
+    float tnear;
+    int node = ::intersect(r, inv_dir, m_nodes[0].volume, tmin, tmax, tnear) ? 0 : -1;
+    while (node != -1) {
+        const auto& current = m_nodes[node];
+        if (stats) {
+            ++stats->nodes;
+        }
+        node = -1;
+        if (current.is_leaf()) {
+            for (int i = current.first; i < current.first + current.count; ++i) {
+                float t = intersect(m_indices[i], tmin, tmax);
+                if (stats) {
+                    ++stats->objects;
+                }
+                if (t >= 0) {
+                    tmax = t;
+                    hit = m_indices[i];
+                    if (AnyHit) {
+                        return hit;
+                    }
+                }
+            }
+        } else {
+            // visit the nearer child first and come back to the other one
+            // if it is still in front of the closest hit
+            float tl, tr;
+            bool hit_left = ::intersect(r, inv_dir, m_nodes[current.left].volume, tmin, tmax, tl);
+            bool hit_right = ::intersect(r, inv_dir, m_nodes[current.right].volume, tmin, tmax, tr);
+            if (hit_left && hit_right) {
+                if (tl <= tr) {
+                    node = current.left;
+                    stack.push({ current.right, tr });
+                } else {
+                    node = current.right;
+                    stack.push({ current.left, tl });
+                }
+            } else if (hit_left) {
+                node = current.left;
+            } else if (hit_right) {
+                node = current.right;
+            }
+        }
+        while (node == -1 && !stack.empty()) {
+            auto e = stack.pop();
+            if (e.tnear < tmax) {
+                node = e.node;
+            }
+        }
+    }
+    return hit;
 }
 
-#endif // BVH_NODE_H
+extern template class wide_bvh_tree<4>;
+extern template class wide_bvh_tree<8>;
+
+#endif // BVH_NODE_H
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "bvh_packet.h"
+#include "bvh_packet_kernel.h"
+
+#if defined(RAYTRACER_SIMD_PACKETS) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+#ifdef RAYTRACER_SIMD_PACKETS
+#  ifdef _MSC_VER
+// the cpu has the features and the os saves the registers they use
+bool cpu_supports(int leaf, int reg, int bit, unsigned long long os_state)
+{
+    int info[4];
+    __cpuid(info, 1);
+    // osxsave
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & os_state) != os_state) {
+        return false;
+    }
+    __cpuidex(info, leaf, 0);
+    return (info[reg] & (1 << bit)) != 0;
+}
+
+bool cpu_supports_avx2()
+{
+    // ebx bit 5 of leaf 7, the ymm state
+    return cpu_supports(7, 1, 5, 0x6);
+}
+
+bool cpu_supports_avx512()
+{
+    // ebx bit 16 of leaf 7, the ymm, zmm and opmask state
+    return cpu_supports(7, 1, 16, 0xe6);
+}
+#  else
+bool cpu_supports_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+bool cpu_supports_avx512()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f");
+}
+#  endif
+#endif // RAYTRACER_SIMD_PACKETS
+
+} // anonymous namespace
+
+bool simd_isa_supported(simd_isa isa)
+{
+    switch (isa) {
+    case simd_isa::scalar:
+        return true;
+#ifdef RAYTRACER_SIMD_PACKETS
+    case simd_isa::sse:
+        return true;
+    case simd_isa::avx2:
+        return cpu_supports_avx2();
+    case simd_isa::avx512:
+        return cpu_supports_avx512();
+#endif
+    default:
+        return false;
+    }
+}
+
+simd_isa best_simd_isa()
+{
+    for (auto isa : { simd_isa::avx512, simd_isa::avx2, simd_isa::sse }) {
+        if (simd_isa_supported(isa)) {
+            return isa;
+        }
+    }
+    return simd_isa::scalar;
+}
+
+int packet_size(simd_isa isa)
+{
+    switch (isa) {
+    case simd_isa::sse:
+        return 4;
+    case simd_isa::avx2:
+        return 8;
+    case simd_isa::avx512:
+        return 16;
+    default:
+        return 1;
+    }
+}
+
+int packet_width(simd_isa isa)
+{
+    // 2x2, 4x2 and 4x4 blocks
+    int size = packet_size(isa);
+    return size >= 8 ? 4 : size >= 4 ? 2 : 1;
+}
+
+const char* simd_isa_name(simd_isa isa)
+{
+    switch (isa) {
+    case simd_isa::sse:
+        return "sse";
+    case simd_isa::avx2:
+        return "avx2";
+    case simd_isa::avx512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+void closest_hit_packet(simd_isa isa, const bvh_tree& tree, const SphereObject* spheres,
+                        const ray* rays, int n, float tmin, float* tmax, int* hits,
+                        traversal_stats* stats)
+{
+    if (tree.nodes().empty()) {
+        for (int i = 0; i < n; ++i) {
+            hits[i] = -1;
+        }
+        return;
+    }
+
+    float initial[max_packet_size];
+    for (int i = 0; i < n; ++i) {
+        initial[i] = tmax[i];
+    }
+    bool done = false;
+#ifdef RAYTRACER_SIMD_PACKETS
+    packet_args args = { tree.nodes().data(), tree.indices().data(), spheres, rays, n, tmin, tmax, hits, stats };
+    switch (isa) {
+    case simd_isa::sse:
+        done = closest_hit_packet_sse(args);
+        break;
+    case simd_isa::avx2:
+        done = closest_hit_packet_avx2(args);
+        break;
+    case simd_isa::avx512:
+        done = closest_hit_packet_avx512(args);
+        break;
+    default:
+        break;
+    }
+#endif
+    if (done) {
+        return;
+    }
+
+    // the scalar traversal, also taken by the packets of the trees too deep for the packet stack
+    for (int i = 0; i < n; ++i) {
+        tmax[i] = initial[i];
+        hits[i] = tree.closest_hit(rays[i], tmin, tmax[i], [&](int k, float tmin, float tmax) {
+            return spheres[k].hit(rays[i], tmin, tmax);
+        }, stats);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef BVH_PACKET_H
+#define BVH_PACKET_H
+
+#pragma once
+
+#include "bvh_node.h"
+#include "sphere_object.h"
+
+// the instruction sets the packet traversal is built for
+enum class simd_isa
+{
+    // one ray at a time with bvh_tree::closest_hit
+    scalar,
+    sse,
+    avx2,
+    avx512
+};
+
+// the most rays a packet carries
+constexpr int max_packet_size = 16;
+
+// whether the cpu and the os support the instruction set, and the build has
+// the traversal for it
+bool simd_isa_supported(simd_isa isa);
+// the widest supported instruction set
+simd_isa best_simd_isa();
+// the number of rays in the packets of the instruction set
+int packet_size(simd_isa isa);
+// the width of the square-ish blocks of pixels traced as one packet
+int packet_width(simd_isa isa);
+const char* simd_isa_name(simd_isa isa);
+
+// find the closest sphere hit by each of the n <= packet_size(isa) rays
+// within [tmin, tmax[i]]. The rays go through the tree together, a node is
+// visited if any of them hits it. tmax[i] is shrunk to the distance of the
+// hit and hits[i] is the object index or -1, the same results as
+// bvh_tree::closest_hit gives for the rays one by one
+void closest_hit_packet(simd_isa isa, const bvh_tree& tree, const SphereObject* spheres,
+                        const ray* rays, int n, float tmin, float* tmax, int* hits,
+                        traversal_stats* stats = nullptr);
+
+#endif // BVH_PACKET_H
\ No newline at end of file
@@ -0,0 +1,154 @@
+#ifndef BVH_PACKET_KERNEL_H
+#define BVH_PACKET_KERNEL_H
+
+#pragma once
+
+// the packet traversal shared by the translation units built for each
+// instruction set. It only touches plain data, anything inline from the
+// other headers could end up compiled for an instruction set the cpu lacks
+
+#include "bvh_node.h"
+#include "sphere_object.h"
+
+struct packet_args
+{
+    const bvh_node* nodes;
+    const int* indices;
+    const SphereObject* spheres;
+    const ray* rays;
+    int n;
+    float tmin;
+    float* tmax;
+    int* hits;
+    traversal_stats* stats;
+};
+
+// return false if the traversal stack overflowed, the results are not
+// complete then. Not declared for the instruction sets the build lacks
+bool closest_hit_packet_sse(const packet_args& args);
+bool closest_hit_packet_avx2(const packet_args& args);
+bool closest_hit_packet_avx512(const packet_args& args);
+
+// V is the float vector of the instruction set, V::mask the result of the
+// comparisons. The operations mirror the scalar code exactly so that the
+// results are the same bit for bit: vmin(a, b) and vmax(a, b) return b
+// unless a is smaller or greater like std::min(b, a) and std::max(b, a)
+template<typename V>
+bool trace_packet(const packet_args& args)
+{
+    using M = typename V::mask;
+    constexpr int N = V::size;
+    constexpr int MaxStackSize = 128;
+
+    // the lanes past n trace the first ray with a negative tmax, they never hit
+    alignas(64) float lanes[10][N];
+    for (int i = 0; i < N; ++i) {
+        const ray& r = args.rays[i < args.n ? i : 0];
+        lanes[0][i] = r.origin.x;
+        lanes[1][i] = r.origin.y;
+        lanes[2][i] = r.origin.z;
+        lanes[3][i] = r.dir.x;
+        lanes[4][i] = r.dir.y;
+        lanes[5][i] = r.dir.z;
+        lanes[6][i] = 1.0f / r.dir.x;
+        lanes[7][i] = 1.0f / r.dir.y;
+        lanes[8][i] = 1.0f / r.dir.z;
+        lanes[9][i] = i < args.n ? args.tmax[i] : -1.0f;
+    }
+    V ox = V::load(lanes[0]), oy = V::load(lanes[1]), oz = V::load(lanes[2]);
+    V dx = V::load(lanes[3]), dy = V::load(lanes[4]), dz = V::load(lanes[5]);
+    V ix = V::load(lanes[6]), iy = V::load(lanes[7]), iz = V::load(lanes[8]);
+    V tmax = V::load(lanes[9]);
+    V tmin = V::set1(args.tmin);
+    V zero = V::set1(0.0f);
+    V a = dx * dx + dy * dy + dz * dz;
+    for (int i = 0; i < args.n; ++i) {
+        args.hits[i] = -1;
+    }
+
+    auto slab = [&](V lo, V hi, V o, V inv, V& tnear, V& tfar) {
+        V t0 = (lo - o) * inv;
+        V t1 = (hi - o) * inv;
+        tnear = vmax(vmin(t1, t0), tnear);
+        tfar = vmin(vmax(t1, t0), tfar);
+    };
+
+    int stack[MaxStackSize];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        const bvh_node& node = args.nodes[stack[--sp]];
+        const aabb3& box = node.volume;
+        V tnear = tmin;
+        V tfar = tmax;
+        slab(V::set1(box.min.x), V::set1(box.max.x), ox, ix, tnear, tfar);
+        slab(V::set1(box.min.y), V::set1(box.max.y), oy, iy, tnear, tfar);
+        slab(V::set1(box.min.z), V::set1(box.max.z), oz, iz, tnear, tfar);
+        if (!any(tnear < tfar)) {
+            continue;
+        }
+        if (args.stats) {
+            ++args.stats->nodes;
+        }
+
+        if (node.left == -1) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                int index = args.indices[i];
+                const SphereObject& sphere = args.spheres[index];
+                V ocx = ox - V::set1(sphere.center.x);
+                V ocy = oy - V::set1(sphere.center.y);
+                V ocz = oz - V::set1(sphere.center.z);
+                V b = ocx * dx + ocy * dy + ocz * dz;
+                V c = (ocx * ocx + ocy * ocy + ocz * ocz) - V::set1(sphere.radius * sphere.radius);
+                V discriminant = b * b - a * c;
+                M valid = discriminant >= zero;
+                if (args.stats) {
+                    ++args.stats->objects;
+                }
+                if (!any(valid)) {
+                    continue;
+                }
+                V sqrtDisr = vsqrt(discriminant);
+                V t1 = (-b - sqrtDisr) / a;
+                V t2 = (-b + sqrtDisr) / a;
+                M hit1 = (tmin <= t1) & (t1 <= tmax);
+                M hit2 = (tmin <= t2) & (t2 <= tmax);
+                M hit = valid & (hit1 | hit2);
+                int bits = movemask(hit);
+                if (bits) {
+                    tmax = blend(hit, blend(hit1, t1, t2), tmax);
+                    for (int k = 0; k < args.n; ++k) {
+                        if (bits >> k & 1) {
+                            args.hits[k] = index;
+                        }
+                    }
+                }
+            }
+        } else {
+            if (sp + 2 > MaxStackSize) {
+                return false;
+            }
+            // visit first the child on the side the first ray comes from
+            const aabb3& left = args.nodes[node.left].volume;
+            const aabb3& right = args.nodes[node.right].volume;
+            float order = (right.min.x + right.max.x - left.min.x - left.max.x) * lanes[3][0] +
+                          (right.min.y + right.max.y - left.min.y - left.max.y) * lanes[4][0] +
+                          (right.min.z + right.max.z - left.min.z - left.max.z) * lanes[5][0];
+            if (order >= 0) {
+                stack[sp++] = node.right;
+                stack[sp++] = node.left;
+            } else {
+                stack[sp++] = node.left;
+                stack[sp++] = node.right;
+            }
+        }
+    }
+
+    V::store(lanes[9], tmax);
+    for (int i = 0; i < args.n; ++i) {
+        args.tmax[i] = lanes[9][i];
+    }
+    return true;
+}
+
+#endif // BVH_PACKET_KERNEL_H
\ No newline at end of file
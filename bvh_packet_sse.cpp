@@ -0,0 +1,7 @@
+#include "bvh_packet_kernel.h"
+#include "simd_sse.h"
+
+bool closest_hit_packet_sse(const packet_args& args)
+{
+    return trace_packet<vfloat>(args);
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "bvh_wide.h"
+#include "bvh_wide_kernel.h"
+
+int wide_leaf_size(simd_isa isa)
+{
+    switch (isa) {
+    case simd_isa::sse:
+        return 16;
+    case simd_isa::avx2:
+    case simd_isa::avx512:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+wide_traversal::wide_traversal(const bvh_tree& tree, const std::vector<SphereObject>& spheres, simd_isa isa)
+    : m_tree(tree)
+    , m_spheres(spheres)
+    , m_isa(isa)
+{
+#ifdef RAYTRACER_SIMD_PACKETS
+    if (tree.nodes().empty()) {
+        m_isa = simd_isa::scalar;
+    } else if (isa == simd_isa::sse) {
+        m_tree4 = std::make_unique<wide_bvh_tree<4>>(tree);
+    } else if (isa == simd_isa::avx2 || isa == simd_isa::avx512) {
+        // 16 lanes would be mostly empty node slots and measured slower
+        // for the leaves too, the avx2 kernel serves avx512
+        m_tree8 = std::make_unique<wide_bvh_tree<8>>(tree);
+    }
+#else
+    m_isa = simd_isa::scalar;
+#endif
+    if (m_isa == simd_isa::scalar) {
+        return;
+    }
+
+    const auto& indices = tree.indices();
+    size_t size = indices.size() + wide_leaf_padding;
+    m_centerX.resize(size);
+    m_centerY.resize(size);
+    m_centerZ.resize(size);
+    m_radius.resize(size);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const auto& sphere = spheres[indices[i]];
+        m_centerX[i] = sphere.center.x;
+        m_centerY[i] = sphere.center.y;
+        m_centerZ[i] = sphere.center.z;
+        m_radius[i] = sphere.radius;
+    }
+}
+
+int wide_traversal::width() const
+{
+    return m_tree4 ? 4 : m_tree8 ? 8 : 2;
+}
+
+int wide_traversal::closest_hit(const ray& r, float tmin, float& tmax, traversal_stats* stats) const
+{
+#ifdef RAYTRACER_SIMD_PACKETS
+    int hit = wide_stack_overflow;
+    float t = tmax;
+    wide_spheres spheres = { m_centerX.data(), m_centerY.data(), m_centerZ.data(), m_radius.data() };
+    if (m_tree4) {
+        hit = closest_hit_wide_sse({ m_tree4->nodes().data(), m_tree.indices().data(), spheres, &r, tmin, &t, stats });
+    } else if (m_tree8) {
+        hit = closest_hit_wide_avx2({ m_tree8->nodes().data(), m_tree.indices().data(), spheres, &r, tmin, &t, stats });
+    }
+    if (hit != wide_stack_overflow) {
+        tmax = t;
+        return hit;
+    }
+#endif
+    // the scalar traversal, also taken by the trees too deep for the stack of the kernels
+    return m_tree.closest_hit(r, tmin, tmax, [&](int i, float tmin, float tmax) {
+        return m_spheres[i].hit(r, tmin, tmax);
+    }, stats);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#pragma once
+
+#include "bvh_node.h"
+#include "bvh_packet.h"
+#include "sphere_object.h"
+
+#include <memory>
+#include <vector>
+
+// the leaf size of the trees traced with the instruction set, picked with
+// the bvh-leaves benchmark
+int wide_leaf_size(simd_isa isa);
+
+// the single ray traversal for the incoherent rays that packets do not help.
+// The tree is collapsed to the number of children the instruction set tests
+// at once: 4 for sse, 8 for avx2 and avx512. The spheres of a leaf are
+// tested at once too, from a copy stored as structure of arrays. The scalar
+// traversal is bvh_tree::closest_hit
+class wide_traversal
+{
+public:
+    // the spheres are the objects of the tree, they must outlive the traversal
+    wide_traversal(const bvh_tree& tree, const std::vector<SphereObject>& spheres, simd_isa isa);
+
+    simd_isa isa() const { return m_isa; }
+    // the number of children tested at once, 2 for the scalar traversal
+    int width() const;
+
+    // the same results as bvh_tree::closest_hit with the spheres as the objects
+    int closest_hit(const ray& r, float tmin, float& tmax, traversal_stats* stats = nullptr) const;
+private:
+    const bvh_tree& m_tree;
+    const std::vector<SphereObject>& m_spheres;
+    simd_isa m_isa;
+    std::unique_ptr<wide_bvh_tree<4>> m_tree4;
+    std::unique_ptr<wide_bvh_tree<8>> m_tree8;
+    // the spheres in the order of the tree indices
+    std::vector<float> m_centerX;
+    std::vector<float> m_centerY;
+    std::vector<float> m_centerZ;
+    std::vector<float> m_radius;
+};
+
+#endif // BVH_WIDE_H
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "bvh_wide_kernel.h"
+#include "simd_avx2.h"
+
+int closest_hit_wide_avx2(const wide_args<8>& args)
+{
+    return trace_wide<vfloat, 8>(args);
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#ifndef BVH_WIDE_KERNEL_H
+#define BVH_WIDE_KERNEL_H
+
+#pragma once
+
+// the single ray traversal of the wide trees, shared by the translation
+// units built for each instruction set. Like the packet kernel it only
+// touches plain data, not even std::swap or std::sqrt that an unoptimized
+// build would emit out of line
+
+#include "bvh_node.h"
+
+// the spheres in the order of bvh_tree::indices() as structure of arrays,
+// the objects of a leaf are tested together. The arrays are padded by
+// wide_leaf_padding so that a full vector can be loaded at any leaf
+struct wide_spheres
+{
+    const float* center_x;
+    const float* center_y;
+    const float* center_z;
+    const float* radius;
+};
+
+constexpr int wide_leaf_padding = 8;
+
+template<int W>
+struct wide_args
+{
+    const wide_bvh_node<W>* nodes;
+    const int* indices;
+    wide_spheres spheres;
+    const ray* r;
+    float tmin;
+    float* tmax;
+    traversal_stats* stats;
+};
+
+// the results of trace_wide besides the object indices
+constexpr int wide_miss = -1;
+constexpr int wide_stack_overflow = -2;
+
+int closest_hit_wide_sse(const wide_args<4>& args);
+int closest_hit_wide_avx2(const wide_args<8>& args);
+
+// test the ray against the W children of a node at once with the W lanes of
+// V. The leaves are intersected when their parent is visited, W of their
+// spheres at once. The inner children are pushed sorted so that the nearest
+// one is visited next.
+// The spheres are tested the way SphereObject::hit does it so that the
+// results match bvh_tree::closest_hit bit for bit
+template<typename V, int W>
+int trace_wide(const wide_args<W>& args)
+{
+    static_assert(V::size == W, "one lane per child");
+    static_assert(W <= wide_leaf_padding, "the spheres are padded for a full vector");
+    constexpr int MaxStackSize = 256;
+    alignas(64) static const float LaneIndex[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+    struct entry
+    {
+        int node;
+        float tnear;
+    };
+
+    const ray& r = *args.r;
+    V ox = V::set1(r.origin.x), oy = V::set1(r.origin.y), oz = V::set1(r.origin.z);
+    V ix = V::set1(1.0f / r.dir.x), iy = V::set1(1.0f / r.dir.y), iz = V::set1(1.0f / r.dir.z);
+    V tmin = V::set1(args.tmin);
+    float tmax = *args.tmax;
+    float a = r.dir.x * r.dir.x + r.dir.y * r.dir.y + r.dir.z * r.dir.z;
+    V dx = V::set1(r.dir.x), dy = V::set1(r.dir.y), dz = V::set1(r.dir.z);
+    V va = V::set1(a), zero = V::set1(0.0f);
+    V lane = V::load(LaneIndex);
+
+    auto slab = [&](V lo, V hi, V o, V inv, V& tnear, V& tfar) {
+        V t0 = (lo - o) * inv;
+        V t1 = (hi - o) * inv;
+        tnear = vmax(vmin(t1, t0), tnear);
+        tfar = vmin(vmax(t1, t0), tfar);
+    };
+
+    entry stack[MaxStackSize];
+    int sp = 0;
+    int hit = wide_miss;
+    int node = 0;
+    while (node != -1) {
+        const wide_bvh_node<W>& current = args.nodes[node];
+        if (args.stats) {
+            ++args.stats->nodes;
+        }
+        V tnear = tmin;
+        V tfar = V::set1(tmax);
+        slab(V::loadu(current.min_x), V::loadu(current.max_x), ox, ix, tnear, tfar);
+        slab(V::loadu(current.min_y), V::loadu(current.max_y), oy, iy, tnear, tfar);
+        slab(V::loadu(current.min_z), V::loadu(current.max_z), oz, iz, tnear, tfar);
+        int bits = movemask(tnear < tfar);
+        alignas(64) float t[W];
+        V::store(t, tnear);
+
+        node = -1;
+        float nodeT = 0;
+        int base = sp;
+        for (; bits; bits &= bits - 1) {
+            int k = 0;
+            while (!(bits >> k & 1)) {
+                ++k;
+            }
+            // the empty slots have inverted bounds that pass the slab test
+            int child = current.child[k];
+            if (child == -1 || t[k] >= tmax) {
+                continue;
+            }
+            if (current.count[k] > 0) {
+                const wide_spheres& spheres = args.spheres;
+                int end = child + current.count[k];
+                for (int i = child; i < end; i += W) {
+                    V ocx = ox - V::loadu(spheres.center_x + i);
+                    V ocy = oy - V::loadu(spheres.center_y + i);
+                    V ocz = oz - V::loadu(spheres.center_z + i);
+                    V radius = V::loadu(spheres.radius + i);
+                    V b = ocx * dx + ocy * dy + ocz * dz;
+                    V c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+                    V discriminant = b * b - va * c;
+                    // the lanes past the end of the leaf read the next leaf or the padding
+                    auto valid = (discriminant >= zero) & (lane < V::set1(float(end - i)));
+                    if (args.stats) {
+                        args.stats->objects += end - i < W ? end - i : W;
+                    }
+                    if (!any(valid)) {
+                        continue;
+                    }
+                    V sqrtDisr = vsqrt(discriminant);
+                    V t1 = (-b - sqrtDisr) / va;
+                    V t2 = (-b + sqrtDisr) / va;
+                    V vtmax = V::set1(tmax);
+                    auto hit1 = (tmin <= t1) & (t1 <= vtmax);
+                    auto hit2 = (tmin <= t2) & (t2 <= vtmax);
+                    int hits = movemask(valid & (hit1 | hit2));
+                    if (!hits) {
+                        continue;
+                    }
+                    alignas(64) float th[W];
+                    V::store(th, blend(hit1, t1, t2));
+                    // in order, the way the scalar traversal shrinks tmax from one sphere to the next
+                    for (; hits; hits &= hits - 1) {
+                        int j = 0;
+                        while (!(hits >> j & 1)) {
+                            ++j;
+                        }
+                        if (th[j] <= tmax) {
+                            tmax = th[j];
+                            hit = args.indices[i + j];
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // keep the nearest inner child to descend into, the others are
+            // pushed with the nearest on top
+            float tc = t[k];
+            if (node == -1 || tc < nodeT) {
+                int nearer = child;
+                child = node;
+                node = nearer;
+                float nearerT = tc;
+                tc = nodeT;
+                nodeT = nearerT;
+            }
+            if (child == -1) {
+                continue;
+            }
+            if (sp == MaxStackSize) {
+                return wide_stack_overflow;
+            }
+            int p = sp++;
+            for (; p > base && stack[p - 1].tnear < tc; --p) {
+                stack[p] = stack[p - 1];
+            }
+            stack[p] = { child, tc };
+        }
+        // a leaf may have been hit in front of the nearest child
+        if (node != -1 && nodeT >= tmax) {
+            node = -1;
+        }
+        while (node == -1 && sp > 0) {
+            --sp;
+            if (stack[sp].tnear < tmax) {
+                node = stack[sp].node;
+            }
+        }
+    }
+    *args.tmax = tmax;
+    return hit;
+}
+
+#endif // BVH_WIDE_KERNEL_H
\ No newline at end of file
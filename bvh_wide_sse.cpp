@@ -0,0 +1,7 @@
+#include "bvh_wide_kernel.h"
+#include "simd_sse.h"
+
+int closest_hit_wide_sse(const wide_args<4>& args)
+{
+    return trace_wide<vfloat, 4>(args);
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#pragma once
+
+#include "ray.h"
+#include <glm/glm.hpp>
+#include <cmath>
+
+// a pinhole camera, the same model as the one of raytracing.fs
+struct Camera
+{
+    glm::vec3 position;
+    glm::vec3 lookAt;
+    // focal length in world unit
+    float focalLength;
+    // vertical fov in rad
+    float fovY;
+
+    // the ray through a point of the image given in pixels from the bottom left corner
+    ray getRay(const glm::vec2& point, const glm::vec2& imageSize) const
+    {
+        glm::vec3 lookDir = glm::normalize(lookAt - position);
+        glm::vec3 right = glm::cross(lookDir, glm::vec3(0, 1, 0));
+        glm::vec3 up = glm::cross(right, lookDir);
+        float halfHeight = std::tan(fovY / 2) * focalLength;
+        float halfWidth = halfHeight * imageSize.x / imageSize.y;
+
+        glm::vec2 p = point / imageSize * 2.0f - 1.0f;
+        glm::vec3 dir = lookDir * focalLength + p.x * right * halfWidth + p.y * up * halfHeight;
+        return { position, glm::normalize(dir) };
+    }
+};
+
+// the camera looking at the sphere field of createScene()
+inline Camera defaultCamera()
+{
+    return { glm::vec3(13, 2, 3), glm::vec3(0), 1.0f, glm::radians(60.0f) };
+}
+
+#endif // CAMERA_H
\ No newline at end of file
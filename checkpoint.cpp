@@ -0,0 +1,143 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+const char Magic[4] = { 'R', 'T', 'C', 'P' };
+constexpr std::uint32_t Version = 2;
+
+// the fields in the byte order of the machine, a checkpoint is resumed
+// where it was written
+struct Header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::int32_t width;
+    std::int32_t height;
+    std::int32_t samples;
+    std::int32_t iterNum;
+    std::uint64_t sceneHash;
+    std::uint32_t hasMoments;
+    std::uint32_t tiled;
+};
+
+void hashBytes(std::uint64_t& hash, const void* data, size_t size)
+{
+    // fnv-1a
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+} // anonymous namespace
+
+Checkpoint::Checkpoint(const std::string& path)
+{
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    Header header;
+    bool valid = std::fread(&header, sizeof(header), 1, f) == 1 &&
+                 std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version &&
+                 header.width > 0 && header.height > 0 && header.samples >= 0 && header.iterNum > 0;
+    if (valid) {
+        width = header.width;
+        height = header.height;
+        samples = header.samples;
+        iterNum = header.iterNum;
+        sceneHash = header.sceneHash;
+        tiled = header.tiled != 0;
+        sums.resize(size_t(width) * height);
+        valid = std::fread(sums.data(), sizeof(glm::vec4), sums.size(), f) == sums.size();
+        if (valid && header.hasMoments) {
+            moments.resize(sums.size());
+            valid = std::fread(moments.data(), sizeof(glm::vec4), moments.size(), f) == moments.size();
+        }
+    }
+    std::fclose(f);
+    if (!valid) {
+        throw std::runtime_error("invalid checkpoint " + path);
+    }
+}
+
+void Checkpoint::save(const std::string& path) const
+{
+    std::string tmpPath = path + ".tmp";
+    FILE* f = std::fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        throw std::runtime_error("failed to open " + tmpPath);
+    }
+    Header header = {};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.width = width;
+    header.height = height;
+    header.samples = samples;
+    header.iterNum = iterNum;
+    header.sceneHash = sceneHash;
+    header.hasMoments = moments.empty() ? 0 : 1;
+    header.tiled = tiled ? 1 : 0;
+    bool written = std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   std::fwrite(sums.data(), sizeof(glm::vec4), sums.size(), f) == sums.size() &&
+                   std::fwrite(moments.data(), sizeof(glm::vec4), moments.size(), f) == moments.size();
+    written = std::fclose(f) == 0 && written;
+    if (!written) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("failed to write " + tmpPath);
+    }
+    // rename does not replace an existing file everywhere
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(path.c_str());
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("failed to replace " + path);
+        }
+    }
+}
+
+void Checkpoint::check(int width, int height, std::uint64_t scene) const
+{
+    if (this->width != width || this->height != height) {
+        throw std::runtime_error("the checkpoint is of a " + std::to_string(this->width) + "x" +
+                                 std::to_string(this->height) + " image");
+    }
+    if (sceneHash != scene) {
+        throw std::runtime_error("the checkpoint is of another scene");
+    }
+}
+
+std::uint64_t sceneHash(const std::vector<SphereObject>& objects)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for (const auto& obj : objects) {
+        hashBytes(hash, &obj.center, sizeof(obj.center));
+        hashBytes(hash, &obj.radius, sizeof(obj.radius));
+        int type = obj.type;
+        hashBytes(hash, &type, sizeof(type));
+        hashBytes(hash, &obj.albedo, sizeof(obj.albedo));
+        hashBytes(hash, &obj.prop, sizeof(obj.prop));
+    }
+    return hash;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& path)
+    : m_path(path)
+    , m_progress(-1)
+{
+}
+
+void CheckpointWriter::write(const Checkpoint& checkpoint, int progress)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (progress <= m_progress) {
+        return;
+    }
+    checkpoint.save(m_path);
+    m_progress = progress;
+}
\ No newline at end of file
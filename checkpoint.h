@@ -0,0 +1,63 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#pragma once
+
+#include "sphere_object.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the state of a progressive render a later run resumes from, written by
+// both backends. The gpu continues all the pixels from samples. An
+// unfinished cpu render is tiled instead: its finished tiles have all their
+// samples and the others none, and only the cpu backend resumes it
+struct Checkpoint
+{
+    Checkpoint() = default;
+    // read a checkpoint written by save
+    explicit Checkpoint(const std::string& path);
+
+    // write next to the path and rename over it, an interrupted write
+    // leaves the previous checkpoint as it is
+    void save(const std::string& path) const;
+    // throw unless the checkpoint is of an image of this size of the scene
+    void check(int width, int height, std::uint64_t scene) const;
+
+    int width = 0;
+    int height = 0;
+    // the samples all the pixels have, the first sample the gpu traces next
+    int samples = 0;
+    // the samples per frame, the gpu seeds its random numbers with them
+    int iterNum = 1;
+    std::uint64_t sceneHash = 0;
+    // the progress is per tile, in the sample counts of the pixels
+    bool tiled = false;
+    // per pixel the sum of the samples and their count, bottom row first
+    std::vector<glm::vec4> sums;
+    // the luminance moments of adaptive sampling, empty without
+    std::vector<glm::vec4> moments;
+};
+
+// a hash of the spheres and their materials
+std::uint64_t sceneHash(const std::vector<SphereObject>& objects);
+
+// writes the checkpoints of a render to one path from any thread, one
+// older than the checkpoint already written is skipped
+class CheckpointWriter
+{
+public:
+    explicit CheckpointWriter(const std::string& path);
+
+    // progress orders the checkpoints, the samples or the tiles rendered
+    void write(const Checkpoint& checkpoint, int progress);
+private:
+    std::string m_path;
+    int m_progress;
+    std::mutex m_mutex;
+};
+
+#endif // CHECKPOINT_H
\ No newline at end of file
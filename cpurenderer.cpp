@@ -0,0 +1,492 @@
+#include "cpurenderer.h"
+#include "thread_pool.h"
+#include "tilecosts.h"
+#include "imagefile.h"
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+
+// the same as the work group size of the compute shader
+constexpr int DefaultTileSize = 16;
+constexpr int MaxIter = 50;
+// the ray length of the ambient occlusion integrator, AO_DISTANCE in the shader
+constexpr float AODistance = 2.0f;
+constexpr float MinDistance = 0.0001f;
+
+// the generator of raytracing.fs, return a random number in the range [0, 1)
+float random(std::uint32_t& seed)
+{
+    seed = 214013u * seed + 2531011u;
+    return ((seed >> 16) & 0x7fff) / float(0x8000);
+}
+
+// spread the pixel indices over the seeds so that neighbouring pixels are not correlated
+std::uint32_t pixelSeed(std::uint32_t index)
+{
+    index = (index ^ 61u) ^ (index >> 16);
+    index *= 9u;
+    index ^= index >> 4;
+    index *= 0x27d4eb2du;
+    index ^= index >> 15;
+    return index;
+}
+
+glm::vec3 randomInUnitSphere(std::uint32_t& seed)
+{
+    glm::vec3 res;
+    do {
+        res.x = random(seed);
+        res.y = random(seed);
+        res.z = random(seed);
+        res = res * 2.0f - 1.0f;
+    } while (glm::dot(res, res) >= 1.0f);
+    return res;
+}
+
+glm::vec3 getBackgroundColor(const glm::vec3& dir)
+{
+    float t = (dir.y + 1.0f) * 0.5f;
+    return glm::vec3(1) * (1 - t) + SkyColor * t;
+}
+
+float schlick(float cosine, float n)
+{
+    float r0 = (1 - n) / (1 + n);
+    r0 *= r0;
+    return r0 + (1.0f - r0) * std::pow(1.0f - cosine, 5.0f);
+}
+
+// the scattering of raytracing.fs, return false if the ray is absorbed
+bool scatter(const SphereObject& sphere, const glm::vec3& rayDir, const glm::vec3& normal,
+             std::uint32_t& seed, glm::vec3& attenuation, glm::vec3& scattered)
+{
+    switch (sphere.type) {
+    case Diffuse:
+        scattered = glm::normalize(normal + randomInUnitSphere(seed));
+        attenuation = sphere.albedo;
+        return true;
+
+    case Metal:
+        scattered = glm::normalize(sphere.prop * randomInUnitSphere(seed) + glm::reflect(rayDir, normal));
+        attenuation = sphere.albedo;
+        return glm::dot(normal, scattered) > 0;
+
+    case Dielectric: {
+        glm::vec3 uin = glm::normalize(rayDir);
+        attenuation = glm::vec3(1);
+
+        float index = sphere.prop;
+        float niOverNt;
+        float cosine = glm::dot(uin, normal);
+        glm::vec3 outward;
+        if (cosine > 0) {
+            niOverNt = index;
+            outward = -normal;
+        } else {
+            niOverNt = 1.0f / index;
+            outward = normal;
+        }
+
+        glm::vec3 refracted = glm::refract(uin, outward, niOverNt);
+        if (cosine > 0) {
+            cosine = std::sqrt(1.0f - index * index * (1.0f - cosine * cosine));
+        } else {
+            cosine = -cosine;
+        }
+        // the shader keeps the null refracted ray of a total internal
+        // reflection, it is reflected here
+        float reflectProb = refracted == glm::vec3(0) ? 1.0f : schlick(cosine, index);
+        if (random(seed) < reflectProb) {
+            scattered = glm::reflect(uin, outward);
+        } else {
+            scattered = refracted;
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+struct CpuRenderer::RayCounts
+{
+    long long primary = 0;
+    long long total = 0;
+    // the hits scattered and the seconds spent on them, binning included
+    long long shaded = 0;
+    double shadingTime = 0;
+};
+
+struct CpuRenderer::Path
+{
+    ray r;
+    glm::vec3 throughput;
+    // the closest hit of r
+    float t;
+    int hit;
+};
+
+CpuRenderer::CpuRenderer(const RenderConfig& config)
+    : m_camera(defaultCamera())
+    , m_integrator(config.integrator)
+    , m_simdIsa(config.simdIsa)
+    , m_sortMaterials(config.sortMaterials)
+    , m_tileSize(config.tileSize > 0 ? config.tileSize : DefaultTileSize)
+    , m_tileOrder(config.tileOrder)
+    , m_tileCostsPath(config.tileCosts)
+    , m_saveTileCosts(config.saveTileCosts)
+    , m_resumePath(config.resumePath)
+    , m_checkpointEvery(config.checkpointEvery)
+    , m_width(config.width)
+    , m_height(config.height)
+    , m_numSamples(config.numSamples)
+    , m_image(config.width * config.height)
+    , m_checkpointsWritten(0)
+    , m_checkpointWriteMs(0)
+{
+    if (m_numSamples <= 0) {
+        throw std::runtime_error("the cpu backend needs a sample count");
+    }
+    if (m_checkpointEvery > 0) {
+        m_checkpoints = std::make_unique<CheckpointWriter>(config.checkpointPath);
+        m_sums.resize(m_image.size());
+        // the render threads only copy the sums, one thread of its own writes them
+        m_writePool = std::make_unique<thread_pool>(2);
+        m_checkpointWrites = std::make_unique<task_group>(m_writePool.get());
+    }
+    auto buildStart = std::chrono::steady_clock::now();
+    m_scene = createScene(config.gridSize, config.bvhBuilder, wide_leaf_size(m_simdIsa), config.materialMix);
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+    std::cout << "Scene Build Time: " << buildTime.count() << "ms\n";
+    m_wideTraversal = std::make_unique<wide_traversal>(*m_scene.bvh, m_scene.objects, m_simdIsa);
+    m_sceneHash = sceneHash(m_scene.objects);
+}
+
+CpuRenderer::~CpuRenderer()
+{
+}
+
+void CpuRenderer::render()
+{
+    auto& pool = thread_pool::instance();
+    // a task per thread, the tasks take the tiles from the scheduler and
+    // steal from each other once they run out
+    int numWorkers = pool.num_threads();
+    std::unique_ptr<TileCosts> previousCosts;
+    if (!m_tileCostsPath.empty()) {
+        previousCosts = std::make_unique<TileCosts>(m_tileCostsPath);
+    }
+    TileScheduler tiles(m_width, m_height, m_tileSize, m_tileOrder, numWorkers, previousCosts.get());
+    TileCosts costs(m_width, m_height);
+    std::vector<RayCounts> counts(numWorkers);
+    std::unique_ptr<Checkpoint> resumed;
+    if (!m_resumePath.empty()) {
+        resumed = std::make_unique<Checkpoint>(m_resumePath);
+        resumed->check(m_width, m_height, m_sceneHash);
+    }
+    std::atomic<int> resumedTiles(0);
+
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(&pool, 0, numWorkers, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            Tile tile;
+            while (tiles.next(i, tile)) {
+                if (resumed && resumeTile(*resumed, tile)) {
+                    ++resumedTiles;
+                } else {
+                    auto tileStart = std::chrono::steady_clock::now();
+                    renderTile(tile.x0, tile.y0, tile.x1, tile.y1, counts[i]);
+                    std::chrono::duration<double, std::milli> tileTime = std::chrono::steady_clock::now() - tileStart;
+                    costs.add(tile, tileTime.count());
+                }
+                if (m_checkpoints) {
+                    checkpointTile(tile);
+                }
+            }
+        }
+    });
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    if (m_checkpoints) {
+        writeCheckpoint(tiles.numTiles());
+        m_checkpointWrites->wait();
+    }
+
+    RayCounts total;
+    for (const auto& c : counts) {
+        total.primary += c.primary;
+        total.total += c.total;
+        total.shaded += c.shaded;
+        total.shadingTime += c.shadingTime;
+    }
+    std::cout << "Render Time: " << time.count() << "s on " << pool.num_threads() << " threads, "
+              << simd_isa_name(m_simdIsa) << " packets, bvh" << m_wideTraversal->width() << " bounces\n";
+    std::cout << "Tiles: " << tiles.numTiles() << " of " << m_tileSize << "x" << m_tileSize << ", "
+              << tiles.numStolen() << " stolen";
+    if (resumed) {
+        std::cout << ", " << resumedTiles << " resumed";
+    }
+    std::cout << "\n";
+    if (m_checkpoints) {
+        std::cout << "Checkpoints: " << m_checkpointsWritten << " written, " << m_checkpointWriteMs
+                  << "ms writing in the background\n";
+    }
+    for (const auto& path : m_saveTileCosts) {
+        costs.save(path);
+    }
+    std::cout << "Primary Rays: " << total.primary / time.count() / 1e6 << "M/s\n";
+    std::cout << "Rays: " << total.total / time.count() / 1e6 << "M/s\n";
+    if (total.shaded) {
+        std::cout << "Shading: " << total.shaded / total.shadingTime / 1e6 << "M hits/s"
+                  << (m_sortMaterials ? ", sorted by material\n" : "\n");
+    }
+}
+
+void CpuRenderer::renderTile(int x0, int y0, int x1, int y1, RayCounts& counts)
+{
+    glm::vec2 size(m_width, m_height);
+    // the pixels of the tile block by block, the primary rays of a block are traced as one packet
+    int packetWidth = packet_width(m_simdIsa);
+    int packetHeight = packet_size(m_simdIsa) / packetWidth;
+    std::vector<int> pixels;
+    std::vector<int> blocks;
+    for (int by = y0; by < y1; by += packetHeight) {
+        for (int bx = x0; bx < x1; bx += packetWidth) {
+            blocks.push_back((int)pixels.size());
+            for (int y = by; y < std::min(by + packetHeight, y1); ++y) {
+                for (int x = bx; x < std::min(bx + packetWidth, x1); ++x) {
+                    pixels.push_back(y * m_width + x);
+                }
+            }
+        }
+    }
+    blocks.push_back((int)pixels.size());
+
+    int n = (int)pixels.size();
+    std::vector<std::uint32_t> seeds(n);
+    std::vector<glm::vec3> colors(n, glm::vec3(0));
+    std::vector<Path> paths(n);
+    for (int k = 0; k < n; ++k) {
+        seeds[k] = pixelSeed(pixels[k]);
+    }
+
+    for (int i = 0; i < m_numSamples; ++i) {
+        for (size_t b = 0; b + 1 < blocks.size(); ++b) {
+            ray rays[max_packet_size];
+            float t[max_packet_size];
+            int hits[max_packet_size];
+            int first = blocks[b];
+            int count = blocks[b + 1] - first;
+            for (int k = 0; k < count; ++k) {
+                // the shader jitters from the pixel center
+                glm::vec2 jitter;
+                jitter.x = random(seeds[first + k]);
+                jitter.y = random(seeds[first + k]);
+                glm::vec2 pixel(pixels[first + k] % m_width + 0.5f, pixels[first + k] / m_width + 0.5f);
+                rays[k] = m_camera.getRay(pixel + jitter, size);
+                t[k] = FLT_MAX;
+            }
+            closest_hit_packet(m_simdIsa, *m_scene.bvh, m_scene.objects.data(), rays, count, MinDistance, t, hits);
+            for (int k = 0; k < count; ++k) {
+                paths[first + k] = { rays[k], glm::vec3(1), t[k], hits[k] };
+            }
+        }
+
+        if (m_integrator == Integrator::AmbientOcclusion) {
+            for (int k = 0; k < n; ++k) {
+                colors[k] += ambientOcclusion(paths[k].r, paths[k].hit, paths[k].t, seeds[k], counts);
+            }
+        } else {
+            pathTrace(paths, seeds, colors, counts);
+        }
+    }
+    counts.primary += n * m_numSamples;
+    counts.total += n * m_numSamples;
+    for (int k = 0; k < n; ++k) {
+        m_image[pixels[k]] = colors[k] / float(m_numSamples);
+    }
+    if (!m_sums.empty()) {
+        for (int k = 0; k < n; ++k) {
+            m_sums[pixels[k]] = glm::vec4(colors[k], m_numSamples);
+        }
+    }
+}
+
+bool CpuRenderer::resumeTile(const Checkpoint& checkpoint, const Tile& tile)
+{
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            if (checkpoint.sums[y * m_width + x].w != m_numSamples) {
+                return false;
+            }
+        }
+    }
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            const auto& sum = checkpoint.sums[y * m_width + x];
+            // the same division as renderTile, the image is the one of an uninterrupted render
+            m_image[y * m_width + x] = glm::vec3(sum) / float(m_numSamples);
+            if (!m_sums.empty()) {
+                m_sums[y * m_width + x] = sum;
+            }
+        }
+    }
+    return true;
+}
+
+void CpuRenderer::checkpointTile(const Tile& tile)
+{
+    int numTiles;
+    {
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        m_checkpointTiles.push_back(tile);
+        numTiles = (int)m_checkpointTiles.size();
+    }
+    if (numTiles % m_checkpointEvery == 0) {
+        writeCheckpoint(numTiles);
+    }
+}
+
+void CpuRenderer::writeCheckpoint(int numTiles)
+{
+    Checkpoint checkpoint;
+    checkpoint.width = m_width;
+    checkpoint.height = m_height;
+    checkpoint.sceneHash = m_sceneHash;
+    checkpoint.sums.resize(m_sums.size(), glm::vec4(0));
+    {
+        // only the first numTiles tiles, the tiles added since may still be written
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        for (int i = 0; i < numTiles; ++i) {
+            const Tile& tile = m_checkpointTiles[i];
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    checkpoint.sums[y * m_width + x] = m_sums[y * m_width + x];
+                }
+            }
+        }
+    }
+    // a finished render is resumed by either backend, an unfinished one only by the cpu
+    bool complete = std::all_of(checkpoint.sums.begin(), checkpoint.sums.end(),
+                                [&](const glm::vec4& sum) { return sum.w == m_numSamples; });
+    checkpoint.samples = complete ? m_numSamples : 0;
+    checkpoint.tiled = !complete;
+    m_checkpointWrites->run([this, numTiles, checkpoint = std::move(checkpoint)] {
+        auto writeStart = std::chrono::steady_clock::now();
+        try {
+            m_checkpoints->write(checkpoint, numTiles);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+        std::chrono::duration<double, std::milli> writeTime = std::chrono::steady_clock::now() - writeStart;
+        std::lock_guard<std::mutex> lock(m_checkpointMutex);
+        ++m_checkpointsWritten;
+        m_checkpointWriteMs += writeTime.count();
+    });
+}
+
+void CpuRenderer::pathTrace(std::vector<Path>& paths, std::vector<std::uint32_t>& seeds,
+                            std::vector<glm::vec3>& colors, RayCounts& counts) const
+{
+    // the paths still alive, they are shaded and extended one bounce after the other
+    std::vector<int> alive;
+    std::vector<int> hits;
+    std::vector<int> order;
+    for (int k = 0; k < (int)paths.size(); ++k) {
+        alive.push_back(k);
+    }
+    for (int i = 0; i < MaxIter && !alive.empty(); ++i) {
+        hits.clear();
+        for (int k : alive) {
+            auto& path = paths[k];
+            if (i > 0) {
+                ++counts.total;
+                path.t = FLT_MAX;
+                path.hit = closestHit(path.r, MinDistance, path.t);
+            }
+            if (path.hit == -1) {
+                colors[k] += path.throughput * getBackgroundColor(path.r.dir);
+            } else {
+                hits.push_back(k);
+            }
+        }
+
+        auto shadingStart = std::chrono::steady_clock::now();
+        const std::vector<int>* shading = &hits;
+        if (m_sortMaterials) {
+            // bin the hits by material so that every run scatters with one material
+            int offsets[MaterialTypeCount + 1] = {};
+            for (int k : hits) {
+                ++offsets[m_scene.objects[paths[k].hit].type + 1];
+            }
+            for (int m = 0; m < MaterialTypeCount; ++m) {
+                offsets[m + 1] += offsets[m];
+            }
+            order.resize(hits.size());
+            for (int k : hits) {
+                order[offsets[m_scene.objects[paths[k].hit].type]++] = k;
+            }
+            shading = &order;
+        }
+
+        alive.clear();
+        for (int k : *shading) {
+            auto& path = paths[k];
+            const auto& sphere = m_scene.objects[path.hit];
+            glm::vec3 pt = path.r.origin + path.t * path.r.dir;
+            glm::vec3 normal = glm::normalize(pt - sphere.center);
+            glm::vec3 attenuation, scattered;
+            if (!scatter(sphere, path.r.dir, normal, seeds[k], attenuation, scattered)) {
+                continue;
+            }
+            path.r = { pt, scattered };
+            path.throughput *= attenuation;
+            if (i + 1 == MaxIter) {
+                colors[k] += path.throughput * getBackgroundColor(path.r.dir);
+            } else {
+                alive.push_back(k);
+            }
+        }
+        std::chrono::duration<double> shadingTime = std::chrono::steady_clock::now() - shadingStart;
+        counts.shadingTime += shadingTime.count();
+        counts.shaded += shading->size();
+    }
+}
+
+glm::vec3 CpuRenderer::ambientOcclusion(ray r, int hit, float t, std::uint32_t& seed, RayCounts& counts) const
+{
+    if (hit == -1) {
+        return getBackgroundColor(r.dir);
+    }
+    const auto& sphere = m_scene.objects[hit];
+    glm::vec3 pt = r.origin + t * r.dir;
+    glm::vec3 normal = glm::normalize(pt - sphere.center);
+    ray shadow = { pt, glm::normalize(normal + randomInUnitSphere(seed)) };
+    ++counts.total;
+    bool occluded = m_scene.bvh->occluded(shadow, MinDistance, AODistance, [&](int i, float tmin, float tmax) {
+        return m_scene.objects[i].hit(shadow, tmin, tmax);
+    });
+    if (occluded) {
+        return glm::vec3(0);
+    }
+    return sphere.albedo * getBackgroundColor(shadow.dir);
+}
+
+int CpuRenderer::closestHit(const ray& r, float tmin, float& tmax) const
+{
+    return m_wideTraversal->closest_hit(r, tmin, tmax);
+}
+
+void CpuRenderer::save(const std::string& path) const
+{
+    saveImage(path, m_width, m_height, m_image);
+}
\ No newline at end of file
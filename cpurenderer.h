@@ -0,0 +1,98 @@
+#ifndef CPU_RENDERER_H
+#define CPU_RENDERER_H
+
+#pragma once
+
+#include "renderer.h"
+#include "scene.h"
+#include "camera.h"
+#include "bvh_wide.h"
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Checkpoint;
+class CheckpointWriter;
+class task_group;
+class thread_pool;
+
+// path traces the scene on the threads of the pool with the integrators of
+// raytracing.fs, the image is split into tiles that are rendered in parallel
+// in the order of the tile scheduler.
+// The primary rays of the blocks of packet_size(simdIsa) pixels are traced
+// as packets, the incoherent bounces one by one against a wide tree. The
+// paths of a tile advance a bounce at a time, so that their hits can be
+// shaded grouped by material.
+// A checkpoint holds the tiles that are done, a resumed render skips the
+// tiles whose pixels have all their samples
+class CpuRenderer
+{
+public:
+    CpuRenderer(const RenderConfig& config);
+    ~CpuRenderer();
+
+    // render all the samples of every pixel
+    void render();
+    // write the image as a png, a pfm or a binary ppm, see saveImage
+    void save(const std::string& path) const;
+
+    // the average color of the pixels, bottom row first
+    const std::vector<glm::vec3>& image() const { return m_image; }
+private:
+    struct RayCounts;
+    struct Path;
+
+    void renderTile(int x0, int y0, int x1, int y1, RayCounts& counts);
+    // take the tile from the checkpoint, false unless all its samples are there
+    bool resumeTile(const Checkpoint& checkpoint, const Tile& tile);
+    // add the tile to the checkpoint, and write it every m_checkpointEvery tiles
+    void checkpointTile(const Tile& tile);
+    void writeCheckpoint(int numTiles);
+    // trace the paths of one sample of the pixels from their primary hits
+    // and add their colors, a bounce of all the paths at a time
+    void pathTrace(std::vector<Path>& paths, std::vector<std::uint32_t>& seeds,
+                   std::vector<glm::vec3>& colors, RayCounts& counts) const;
+    // continue from the closest hit of the primary ray, -1 if it missed
+    glm::vec3 ambientOcclusion(ray r, int hit, float t, std::uint32_t& seed, RayCounts& counts) const;
+    // the closest hit of a bounce ray
+    int closestHit(const ray& r, float tmin, float& tmax) const;
+
+    Scene m_scene;
+    Camera m_camera;
+    Integrator m_integrator;
+    simd_isa m_simdIsa;
+    // shade the hits of a bounce grouped by material
+    bool m_sortMaterials;
+    int m_tileSize;
+    TileOrder m_tileOrder;
+    // the costs the cost tile order reads and the paths the measured ones are saved to
+    std::string m_tileCostsPath;
+    std::vector<std::string> m_saveTileCosts;
+    std::unique_ptr<wide_traversal> m_wideTraversal;
+    std::uint64_t m_sceneHash;
+    std::string m_resumePath;
+    // null unless checkpoints are written
+    std::unique_ptr<CheckpointWriter> m_checkpoints;
+    int m_checkpointEvery;
+    int m_width;
+    int m_height;
+    int m_numSamples;
+
+    std::vector<glm::vec3> m_image;
+    // the sums of the samples and their count of the pixels, checkpoints only
+    std::vector<glm::vec4> m_sums;
+    // the tiles that are done, their pixels are no longer written
+    std::vector<Tile> m_checkpointTiles;
+    std::mutex m_checkpointMutex;
+    int m_checkpointsWritten;
+    double m_checkpointWriteMs;
+    // declared last, the writes in flight are waited for before the rest is destroyed
+    std::unique_ptr<thread_pool> m_writePool;
+    std::unique_ptr<task_group> m_checkpointWrites;
+};
+
+#endif // CPU_RENDERER_H
\ No newline at end of file
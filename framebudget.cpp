@@ -0,0 +1,83 @@
+#include "framebudget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+
+// the weight of the latest frame in the time of a unit of work
+constexpr double Smoothing = 0.5;
+// the most the budget grows in one update, a frame measured too short does not overshoot
+constexpr double MaxGrowth = 4.0;
+// the updates in a row within this fraction of the budget that count as converged
+constexpr double Tolerance = 0.1;
+constexpr int StableUpdates = 3;
+// the frames in flight that are timed
+constexpr int NumTimedFrames = 4;
+
+} // anonymous namespace
+
+FrameBudget::FrameBudget(const char* unit, float targetMs, int minWork, int maxWork)
+    : m_timer(NumTimedFrames)
+    , m_unit(unit)
+    , m_targetMs(targetMs)
+    , m_minWork(minWork)
+    , m_maxWork(maxWork)
+    , m_work(minWork)
+    , m_unitMs(0)
+    , m_stableUpdates(0)
+    , m_logged(false)
+{
+}
+
+void FrameBudget::beginFrame()
+{
+    update();
+    m_timer.begin();
+}
+
+void FrameBudget::endFrame(int work)
+{
+    m_timer.end(work);
+}
+
+void FrameBudget::update()
+{
+    int work;
+    double ms;
+    while (m_timer.poll(work, ms)) {
+        if (work <= 0) {
+            continue;
+        }
+        double unitMs = ms / work;
+        m_unitMs = m_unitMs == 0 ? unitMs : m_unitMs * (1 - Smoothing) + unitMs * Smoothing;
+
+        // stay within the target, a frame over it hitches
+        double fit = std::floor(m_targetMs / std::max(m_unitMs, 1e-9));
+        fit = std::min(fit, std::ceil(m_work * MaxGrowth));
+        int budget = (int)std::clamp(fit, (double)m_minWork, (double)m_maxWork);
+        if (std::abs(budget - m_work) <= m_work * Tolerance) {
+            ++m_stableUpdates;
+        } else {
+            m_stableUpdates = 0;
+        }
+        m_work = budget;
+
+        if (!m_logged && m_stableUpdates == StableUpdates) {
+            report();
+            m_logged = true;
+        }
+    }
+}
+
+void FrameBudget::report() const
+{
+    if (m_unitMs == 0) {
+        std::cout << "Frame Budget: " << m_work << " " << m_unit << "/frame, no frame measured\n";
+        return;
+    }
+    std::cout << "Frame Budget: " << m_work << " " << m_unit << "/frame, " << 1000 / m_unitMs << " "
+              << m_unit << "/s at " << m_work * m_unitMs << "ms/frame\n";
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+#pragma once
+
+#include "gputimer.h"
+
+// scales the work done per frame, such as the samples or the pixels of the
+// tiles traced, to a target frame time. The gpu time of the frames is read
+// back a few frames later so that the frames are not serialized
+class FrameBudget
+{
+public:
+    // a budget between minWork and maxWork, unit names the work in the log
+    FrameBudget(const char* unit, float targetMs, int minWork, int maxWork);
+
+    FrameBudget(FrameBudget&) = delete;
+
+    // adjust the budget to the frames measured so far and time the commands
+    // issued up to endFrame, which do the given work
+    void beginFrame();
+    void endFrame(int work);
+
+    // the work to do this frame
+    int work() const { return m_work; }
+    // print the budget and the rate it is based on
+    void report() const;
+private:
+    // read back the finished frames and adjust the budget
+    void update();
+
+    // the spans are tagged with the work of the frame
+    GpuTimer m_timer;
+
+    const char* m_unit;
+    float m_targetMs;
+    int m_minWork;
+    int m_maxWork;
+    int m_work;
+    // the smoothed gpu time of a unit of work, 0 until the first frame is measured
+    double m_unitMs;
+    // the updates in a row that left the budget as it is
+    int m_stableUpdates;
+    bool m_logged;
+};
+
+#endif // FRAME_BUDGET_H
\ No newline at end of file
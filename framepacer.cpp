@@ -0,0 +1,68 @@
+#include "framepacer.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+
+// a frame that is not done after a wait is reported and waited for again,
+// for as long as it takes. A long frame is not a lost one, e.g. a batch
+// frame of many samples on a software renderer
+constexpr int WaitTimeoutS = 10;
+
+} // anonymous namespace
+
+FramePacer::FramePacer(int framesInFlight)
+    : m_fences(framesInFlight, nullptr)
+    , m_head(0)
+    , m_count(0)
+    , m_waitMs(0)
+{
+    if (framesInFlight < 1) {
+        throw std::runtime_error("at least one frame has to be in flight");
+    }
+}
+
+FramePacer::~FramePacer()
+{
+    for (GLsync fence : m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+}
+
+void FramePacer::beginFrame()
+{
+    if (m_count < (int)m_fences.size()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    GLsync& fence = m_fences[m_head];
+    for (int waits = 1;; ++waits) {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(WaitTimeoutS) * 1000000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+            break;
+        }
+        if (result == GL_WAIT_FAILED) {
+            throw std::runtime_error("failed to wait for a frame");
+        }
+        std::cerr << "waiting for a frame for " << waits * WaitTimeoutS << "s\n";
+    }
+    m_waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    glDeleteSync(fence);
+    fence = nullptr;
+    m_head = (m_head + 1) % (int)m_fences.size();
+    --m_count;
+}
+
+void FramePacer::endFrame()
+{
+    int tail = (m_head + m_count) % (int)m_fences.size();
+    m_fences[tail] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++m_count;
+}
\ No newline at end of file
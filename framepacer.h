@@ -0,0 +1,37 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// keeps at most a number of frames in flight with a fence at the end of each
+// frame, instead of draining the pipeline every frame. The cpu waits for the
+// oldest frame only when it is about to issue one frame too many
+class FramePacer
+{
+public:
+    explicit FramePacer(int framesInFlight);
+    ~FramePacer();
+
+    FramePacer(FramePacer&) = delete;
+
+    // wait until a frame can be issued
+    void beginFrame();
+    // fence the commands of the frame issued since beginFrame
+    void endFrame();
+
+    int framesInFlight() const { return (int)m_fences.size(); }
+    // the time the cpu spent waiting for the gpu
+    double waitMs() const { return m_waitMs; }
+private:
+    // the fences of the frames in flight, in the order they were issued
+    std::vector<GLsync> m_fences;
+    // the oldest frame and the number of frames in flight
+    int m_head;
+    int m_count;
+    double m_waitMs;
+};
+
+#endif // FRAME_PACER_H
\ No newline at end of file
@@ -9,6 +9,10 @@ using std::string;
 
 #include <sstream>
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <sys/stat.h>
 
 namespace GLSLShaderInfo {
@@ -31,7 +35,34 @@ namespace GLSLShaderInfo {
             };
 }
 
-GLSLProgram::GLSLProgram() : handle(0), linked(false), newVersion(0) {}
+namespace {
+    // the header of a cached program binary
+    struct BinaryHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint32_t format;
+        std::uint32_t length;
+    };
+
+    const char BinaryMagic[4] = {'R', 'T', 'P', 'B'};
+    const std::uint32_t BinaryVersion = 1;
+
+    // fnv-1a
+    void hashBytes(std::uint64_t &hash, const void *data, size_t size) {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    void hashString(std::uint64_t &hash, const char *str) {
+        // the terminator separates the strings
+        hashBytes(hash, str, strlen(str) + 1);
+    }
+} // anonymous namespace
+
+GLSLProgram::GLSLProgram() : handle(0), linked(false), newVersion(0), loadedFromCache(false) {}
 
 GLSLProgram::~GLSLProgram() {
     if (handle == 0) return;
@@ -69,6 +100,16 @@ void GLSLProgram::overrideVersion(int version)
     newVersion = version;
 }
 
+void GLSLProgram::cacheBinary(const std::string &dir)
+{
+    binaryCacheDir = dir;
+}
+
+bool GLSLProgram::isCached()
+{
+    return loadedFromCache;
+}
+
 void GLSLProgram::compileShader(const char *fileName) {
     int numExts = sizeof(GLSLShaderInfo::extensions) / sizeof(GLSLShaderInfo::shader_file_extension);
 
@@ -142,8 +183,6 @@ void GLSLProgram::compileShader(const string &source,
         }
     }
 
-    GLuint shaderHandle = glCreateShader(type);
-
     // find the version line
     const char* sources[4];
     int lens[4];
@@ -208,7 +247,24 @@ void GLSLProgram::compileShader(const string &source,
     lens[i] = source.size() - versionEnd;
     ++i;
 
-    glShaderSource(shaderHandle, i, sources, lens);       
+    string code;
+    for (int j = 0; j < i; ++j) {
+        code.append(sources[j], lens[j]);
+    }
+    if (binaryCacheDir.empty()) {
+        compileAndAttach(code, type, fileName);
+    } else {
+        pendingShaders.push_back({type, code, fileName ? fileName : ""});
+    }
+}
+
+void GLSLProgram::compileAndAttach(const string &code, GLSLShader::GLSLShaderType type,
+                                   const char *fileName) {
+    GLuint shaderHandle = glCreateShader(type);
+
+    const char *source = code.c_str();
+    int len = code.size();
+    glShaderSource(shaderHandle, 1, &source, &len);
 
     // Compile the shader
     glCompileShader(shaderHandle);
@@ -229,7 +285,7 @@ void GLSLProgram::compileShader(const string &source,
             delete[] c_log;
         }
         string msg;
-        if (fileName) {
+        if (fileName && *fileName) {
             msg = string(fileName) + ": shader compliation failed\n";
         } else {
             msg = "Shader compilation failed.\n";
@@ -249,8 +305,32 @@ void GLSLProgram::link() {
     if (handle <= 0)
         throw GLSLProgramException("Program has not been compiled.");
 
+    if (pendingShaders.empty()) {
+        glLinkProgram(handle);
+        checkLinkStatus();
+        return;
+    }
+
+    string path = binaryCachePath();
+    if (loadBinary(path)) {
+        pendingShaders.clear();
+        loadedFromCache = true;
+        findUniformLocations();
+        linked = true;
+        return;
+    }
+
+    for (const auto &shader : pendingShaders) {
+        compileAndAttach(shader.code, shader.type, shader.fileName.c_str());
+    }
+    pendingShaders.clear();
+    glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(handle);
+    checkLinkStatus();
+    saveBinary(path);
+}
 
+void GLSLProgram::checkLinkStatus() {
     int status = 0;
     glGetProgramiv(handle, GL_LINK_STATUS, &status);
     if (GL_FALSE == status) {
@@ -275,6 +355,107 @@ void GLSLProgram::link() {
     }
 }
 
+string GLSLProgram::binaryCachePath() {
+    // a binary is only valid for the driver that linked it
+    std::uint64_t hash = 14695981039346656037ull;
+    hashBytes(hash, &BinaryVersion, sizeof(BinaryVersion));
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+        auto str = reinterpret_cast<const char *>(glGetString(name));
+        hashString(hash, str ? str : "");
+    }
+    // the code of a shader starts with the version and the defines
+    for (const auto &shader : pendingShaders) {
+        std::uint32_t type = shader.type;
+        hashBytes(hash, &type, sizeof(type));
+        hashString(hash, shader.code.c_str());
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+    return (std::filesystem::path(binaryCacheDir) / name).string();
+}
+
+bool GLSLProgram::loadBinary(const string &path) {
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats == 0) return false;
+    std::vector<GLint> formats(numFormats);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    // a corrupt header is not trusted with the size of the binary
+    fseek(f, 0, SEEK_END);
+    long fileSize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    BinaryHeader header;
+    std::vector<char> binary;
+    bool read = fileSize >= (long)sizeof(header) &&
+                fread(&header, sizeof(header), 1, f) == 1 &&
+                header.length == fileSize - sizeof(header) &&
+                memcmp(header.magic, BinaryMagic, sizeof(BinaryMagic)) == 0 &&
+                header.version == BinaryVersion &&
+                std::find(formats.begin(), formats.end(), (GLint)header.format) != formats.end();
+    if (read) {
+        binary.resize(header.length);
+        read = fread(binary.data(), 1, binary.size(), f) == binary.size();
+    }
+    fclose(f);
+    if (!read) return false;
+
+    glProgramBinary(handle, header.format, binary.data(), binary.size());
+    GLint status = 0;
+    glGetProgramiv(handle, GL_LINK_STATUS, &status);
+    if (GL_TRUE == status) return true;
+
+    // the driver rejects the binary, e.g. after an update that kept the
+    // version string, start over with an empty program
+    glDeleteProgram(handle);
+    handle = glCreateProgram();
+    if (handle == 0) {
+        throw GLSLProgramException("Unable to create shader program.");
+    }
+    return false;
+}
+
+void GLSLProgram::saveBinary(const string &path) {
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    GLint length = 0;
+    glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (numFormats == 0 || length == 0) return;
+
+    BinaryHeader header = {};
+    memcpy(header.magic, BinaryMagic, sizeof(BinaryMagic));
+    header.version = BinaryVersion;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(handle, length, &length, &format, binary.data());
+    header.format = format;
+    header.length = length;
+
+    // a failed write costs the next launch a compile, it is not an error
+    std::error_code ec;
+    std::filesystem::create_directories(binaryCacheDir, ec);
+    string tmpPath = path + ".tmp";
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        std::cout << "Unable to write the program cache " << tmpPath << std::endl;
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(binary.data(), 1, header.length, f) == header.length;
+    written = fclose(f) == 0 && written;
+    // rename does not replace an existing file everywhere
+    if (written && rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(path.c_str());
+        written = rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+    if (!written) {
+        remove(tmpPath.c_str());
+        std::cout << "Unable to write the program cache " << path << std::endl;
+    }
+}
+
 void GLSLProgram::findUniformLocations() {
     uniformLocations.clear();
 
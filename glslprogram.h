@@ -36,6 +36,28 @@ private:
     std::map<std::string, int> uniformLocations;
     std::vector<std::string> defines;
     int newVersion;
+    // the directory of the linked binaries, empty compiles every time
+    std::string binaryCacheDir;
+    // with a binary cache the shaders are compiled by link, and only if
+    // the program is not in the cache
+    struct PendingShader {
+        GLSLShader::GLSLShaderType type;
+        std::string code;
+        std::string fileName;
+    };
+    std::vector<PendingShader> pendingShaders;
+    bool loadedFromCache;
+
+    void compileAndAttach(const std::string &code, GLSLShader::GLSLShaderType type,
+                          const char *fileName);
+
+    std::string binaryCachePath();
+
+    bool loadBinary(const std::string &path);
+
+    void saveBinary(const std::string &path);
+
+    void checkLinkStatus();
 
     GLint getUniformLocation(const char *name);
 
@@ -58,6 +80,13 @@ public:
 
     void overrideVersion(int version);
 
+    // keep the linked program in dir, keyed by the sources, the defines, the
+    // version and the driver, and load it from there instead of compiling
+    void cacheBinary(const std::string &dir);
+
+    // whether link loaded the program from the binary cache
+    bool isCached();
+
     void compileShader(const char *fileName);
 
     void compileShader(const char *fileName, GLSLShader::GLSLShaderType type);
@@ -5,6 +5,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <cstdio>
+#include <cstring>
 #include <string>
 
 using std::string;
@@ -179,6 +180,18 @@ void dumpGLInfo(bool dumpExtensions) {
     }
 }
 
+bool extensionSupported(const char* name)
+{
+    GLint nExtensions;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+    for (int i = 0; i < nExtensions; ++i) {
+        if (std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 GLuint createFullScreenQuad()
 {
     // Array for quad
@@ -10,6 +10,8 @@ namespace GLUtils
     int checkForOpenGLError(const char *, int);
     
     void dumpGLInfo(bool dumpExtensions = false);
+    // whether the current context supports the extension, with or without a window
+    bool extensionSupported(const char* name);
     
     void APIENTRY debugCallback( GLenum source, GLenum type, GLuint id,
 		GLenum severity, GLsizei length, const GLchar * msg, const void * param );
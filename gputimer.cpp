@@ -0,0 +1,61 @@
+#include "gputimer.h"
+
+GpuTimer::GpuTimer(int capacity)
+    : m_queries(capacity * 2)
+    , m_tags(capacity)
+    , m_head(0)
+    , m_count(0)
+    , m_open(-1)
+    , m_dropped(0)
+{
+    glGenQueries((GLsizei)m_queries.size(), m_queries.data());
+}
+
+GpuTimer::~GpuTimer()
+{
+    glDeleteQueries((GLsizei)m_queries.size(), m_queries.data());
+}
+
+void GpuTimer::begin()
+{
+    int capacity = (int)m_tags.size();
+    if (m_count == capacity) {
+        m_open = -1;
+        ++m_dropped;
+        return;
+    }
+    m_open = (m_head + m_count) % capacity;
+    glQueryCounter(m_queries[m_open * 2], GL_TIMESTAMP);
+}
+
+void GpuTimer::end(int tag)
+{
+    if (m_open == -1) {
+        return;
+    }
+    m_tags[m_open] = tag;
+    glQueryCounter(m_queries[m_open * 2 + 1], GL_TIMESTAMP);
+    ++m_count;
+    m_open = -1;
+}
+
+bool GpuTimer::poll(int& tag, double& ms)
+{
+    if (m_count == 0) {
+        return false;
+    }
+    // the timestamps are written in order, the end of a span is the last
+    GLint ready;
+    glGetQueryObjectiv(m_queries[m_head * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &ready);
+    if (!ready) {
+        return false;
+    }
+    GLuint64 start, end;
+    glGetQueryObjectui64v(m_queries[m_head * 2], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(m_queries[m_head * 2 + 1], GL_QUERY_RESULT, &end);
+    tag = m_tags[m_head];
+    ms = (end - start) / 1e6;
+    m_head = (m_head + 1) % (int)m_tags.size();
+    --m_count;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// times spans of gpu commands with a ring of timestamp query pairs. The
+// results are polled in the order the spans were issued and are never
+// waited for, a span is dropped if the ring is full when it begins
+class GpuTimer
+{
+public:
+    explicit GpuTimer(int capacity);
+    ~GpuTimer();
+
+    GpuTimer(GpuTimer&) = delete;
+
+    // time the commands issued up to end, the tag identifies the span when it is polled
+    void begin();
+    void end(int tag);
+
+    // take the oldest span if its result is available, without blocking
+    bool poll(int& tag, double& ms);
+    // the spans issued and not polled yet
+    int pending() const { return m_count; }
+    int dropped() const { return m_dropped; }
+private:
+    // the timestamps of the start and the end of each span
+    std::vector<GLuint> m_queries;
+    std::vector<int> m_tags;
+    // the oldest span and the number of spans in the ring
+    int m_head;
+    int m_count;
+    // the span between begin and end, -1 if none or dropped
+    int m_open;
+    int m_dropped;
+};
+
+#endif // GPU_TIMER_H
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "headlesscontext.h"
+
+#include <stdexcept>
+#include <string>
+
+#ifdef RAYTRACER_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+
+namespace
+{
+
+std::string eglError(const char* what)
+{
+    char code[16];
+    std::snprintf(code, sizeof(code), "0x%x", eglGetError());
+    return std::string(what) + ", egl error " + code;
+}
+
+EGLDisplay getDisplay()
+{
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions && std::string(extensions).find("EGL_MESA_platform_surfaceless") != std::string::npos) {
+        auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay) {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+} // anonymous namespace
+
+HeadlessContext::HeadlessContext(int width, int height, bool debug)
+    : m_display(EGL_NO_DISPLAY)
+    , m_surface(EGL_NO_SURFACE)
+    , m_context(EGL_NO_CONTEXT)
+{
+    m_display = getDisplay();
+    EGLint major, minor;
+    if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+        throw std::runtime_error(eglError("failed to initialize egl"));
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        eglTerminate(m_display);
+        throw std::runtime_error(eglError("egl does not support opengl"));
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(m_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        eglTerminate(m_display);
+        throw std::runtime_error(eglError("no egl config with an opengl pbuffer"));
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_CONTEXT_OPENGL_DEBUG, debug ? EGL_TRUE : EGL_FALSE,
+        EGL_NONE
+    };
+    m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (m_context == EGL_NO_CONTEXT) {
+        eglTerminate(m_display);
+        throw std::runtime_error(eglError("failed to create an opengl 4.3 context"));
+    }
+
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    m_surface = eglCreatePbufferSurface(m_display, config, surfaceAttribs);
+    if (m_surface == EGL_NO_SURFACE || !eglMakeCurrent(m_display, m_surface, m_surface, m_context)) {
+        std::string error = eglError("failed to make the headless context current");
+        eglDestroyContext(m_display, m_context);
+        eglTerminate(m_display);
+        throw std::runtime_error(error);
+    }
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroySurface(m_display, m_surface);
+    eglDestroyContext(m_display, m_context);
+    eglTerminate(m_display);
+}
+
+#else
+
+HeadlessContext::HeadlessContext(int, int, bool)
+    : m_display(nullptr)
+    , m_surface(nullptr)
+    , m_context(nullptr)
+{
+    throw std::runtime_error("the headless mode needs egl, which was not found at build time");
+}
+
+HeadlessContext::~HeadlessContext()
+{
+}
+
+#endif // RAYTRACER_EGL
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#pragma once
+
+// an opengl 4.3 core context without a window, on the surfaceless egl
+// platform of mesa if there is one and on the default display otherwise,
+// so that the renderer runs on the machines without a display or a gpu.
+// The context draws to a pbuffer of the size of the image
+class HeadlessContext
+{
+public:
+    HeadlessContext(int width, int height, bool debug);
+    ~HeadlessContext();
+
+    HeadlessContext(HeadlessContext&) = delete;
+private:
+    // the egl handles, egl.h is included only where egl is found
+    void* m_display;
+    void* m_surface;
+    void* m_context;
+};
+
+#endif // HEADLESS_CONTEXT_H
\ No newline at end of file
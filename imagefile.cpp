@@ -0,0 +1,158 @@
+#include "imagefile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+
+// the largest block of a stored deflate stream
+constexpr size_t MaxStoredBlock = 65535;
+
+bool endsWith(const std::string& s, const char* suffix)
+{
+    std::string end(suffix);
+    return s.size() >= end.size() && s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
+unsigned char toByte(float c)
+{
+    return (unsigned char)(std::clamp(c, 0.0f, 1.0f) * 255 + 0.5f);
+}
+
+// the 8 bit rows of the image, top row first
+std::vector<unsigned char> toBytes(int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::vector<unsigned char> bytes(width * height * 3);
+    for (int y = 0; y < height; ++y) {
+        const glm::vec3* row = &pixels[(height - 1 - y) * width];
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                bytes[(y * width + x) * 3 + c] = toByte(row[x][c]);
+            }
+        }
+    }
+    return bytes;
+}
+
+std::uint32_t crc32(const unsigned char* data, size_t size, std::uint32_t crc = 0)
+{
+    static const auto table = [] {
+        std::vector<std::uint32_t> t(256);
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void putBigEndian(std::vector<unsigned char>& out, std::uint32_t v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+bool writeChunk(FILE* f, const char* type, const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> chunk;
+    putBigEndian(chunk, (std::uint32_t)data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBigEndian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+    return std::fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+}
+
+// the savers return false if a write fails
+
+// a png of the stored, uncompressed, deflate blocks, so that no zlib is needed
+bool savePng(FILE* f, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::vector<unsigned char> bytes = toBytes(width, height, pixels);
+    // each row starts with the filter type, none
+    std::vector<unsigned char> raw;
+    raw.reserve(bytes.size() + height);
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), bytes.begin() + y * width * 3, bytes.begin() + (y + 1) * width * 3);
+    }
+
+    std::vector<unsigned char> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    // 8 bits per channel rgb, deflate, no filter method, no interlace
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    std::uint32_t a = 1, b = 0;
+    for (size_t start = 0; start == 0 || start < raw.size(); start += MaxStoredBlock) {
+        size_t size = std::min(MaxStoredBlock, raw.size() - start);
+        zlib.push_back(start + size == raw.size() ? 1 : 0);
+        zlib.push_back((unsigned char)size);
+        zlib.push_back((unsigned char)(size >> 8));
+        zlib.push_back((unsigned char)~size);
+        zlib.push_back((unsigned char)(~size >> 8));
+        zlib.insert(zlib.end(), raw.begin() + start, raw.begin() + start + size);
+    }
+    for (unsigned char c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(zlib, b << 16 | a);
+
+    static const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    return std::fwrite(signature, 1, sizeof(signature), f) == sizeof(signature) &&
+           writeChunk(f, "IHDR", header) &&
+           writeChunk(f, "IDAT", zlib) &&
+           writeChunk(f, "IEND", {});
+}
+
+// the rows of a pfm are bottom first, a negative scale marks little endian floats
+bool savePfm(FILE* f, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    const std::uint16_t one = 1;
+    bool littleEndian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+    return std::fprintf(f, "PF\n%d %d\n%s\n", width, height, littleEndian ? "-1.0" : "1.0") > 0 &&
+           std::fwrite(pixels.data(), sizeof(glm::vec3), pixels.size(), f) == pixels.size();
+}
+
+bool savePpm(FILE* f, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::vector<unsigned char> bytes = toBytes(width, height, pixels);
+    return std::fprintf(f, "P6\n%d %d\n255\n", width, height) > 0 &&
+           std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+}
+
+} // anonymous namespace
+
+void saveImage(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    bool written;
+    if (endsWith(path, ".png")) {
+        written = savePng(f, width, height, pixels);
+    } else if (endsWith(path, ".pfm")) {
+        written = savePfm(f, width, height, pixels);
+    } else {
+        written = savePpm(f, width, height, pixels);
+    }
+    written = std::fclose(f) == 0 && written;
+    if (!written) {
+        throw std::runtime_error("failed to write " + path);
+    }
+}
\ No newline at end of file
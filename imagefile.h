@@ -0,0 +1,14 @@
+#ifndef IMAGE_FILE_H
+#define IMAGE_FILE_H
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// write the pixels, bottom row first, in the format of the extension of the
+// path: .png and .ppm clamp to 8 bits, .pfm keeps the floats
+void saveImage(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels);
+
+#endif // IMAGE_FILE_H
\ No newline at end of file
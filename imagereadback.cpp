@@ -0,0 +1,104 @@
+#include "imagereadback.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+ImageReadback::ImageReadback(int width, int height, int numBuffers, int numTextures)
+    : m_width(width)
+    , m_height(height)
+    , m_numTextures(numTextures)
+    , m_buffers(numBuffers)
+    , m_fences(numBuffers, nullptr)
+    , m_tags(numBuffers)
+    , m_head(0)
+    , m_count(0)
+    , m_dropped(0)
+{
+    GLsizeiptr size = sizeof(glm::vec4) * width * height * numTextures;
+    glGenBuffers(numBuffers, m_buffers.data());
+    for (GLuint buffer : m_buffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+ImageReadback::~ImageReadback()
+{
+    for (GLsync fence : m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers((GLsizei)m_buffers.size(), m_buffers.data());
+}
+
+bool ImageReadback::read(const std::vector<GLuint>& textures, int tag)
+{
+    int capacity = (int)m_buffers.size();
+    if (m_count == capacity) {
+        ++m_dropped;
+        return false;
+    }
+    int slot = (m_head + m_count) % capacity;
+
+    // the image stores of the compute shader are visible to the copy
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[slot]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (int i = 0; i < m_numTextures; ++i) {
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        size_t offset = sizeof(glm::vec4) * m_width * m_height * i;
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, reinterpret_cast<void*>(offset));
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_tags[slot] = tag;
+    ++m_count;
+    return true;
+}
+
+void ImageReadback::poll(const callback_t& cb, bool wait)
+{
+    while (m_count > 0) {
+        GLsync& fence = m_fences[m_head];
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+        if (result == GL_WAIT_FAILED) {
+            throw std::runtime_error("failed to wait for an image readback");
+        }
+        if (result == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        std::vector<glm::vec4> pixels(size_t(m_width) * m_height * m_numTextures);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[m_head]);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(glm::vec4) * pixels.size(), GL_MAP_READ_BIT);
+        if (!data) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            throw std::runtime_error("failed to map an image readback");
+        }
+        std::memcpy(pixels.data(), data, sizeof(glm::vec4) * pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        int tag = m_tags[m_head];
+        m_head = (m_head + 1) % (int)m_buffers.size();
+        --m_count;
+        if (cb) {
+            cb(tag, std::move(pixels));
+        }
+    }
+}
+
+std::vector<glm::vec3> ImageReadback::resolve(const std::vector<glm::vec4>& sums)
+{
+    std::vector<glm::vec3> image(sums.size());
+    for (size_t i = 0; i < sums.size(); ++i) {
+        image[i] = glm::vec3(sums[i]) / std::max(sums[i].w, 1.0f);
+    }
+    return image;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef IMAGE_READBACK_H
+#define IMAGE_READBACK_H
+
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+// copies rgba float textures to the cpu without waiting for the gpu,
+// through a ring of pixel buffers with a fence each. The copies are polled
+// in the order they were issued, a copy is dropped if all the buffers are
+// in flight
+class ImageReadback
+{
+public:
+    // the pixels of the textures one after the other, bottom row first, and
+    // the tag of the copy
+    using callback_t = std::function<void(int tag, std::vector<glm::vec4> pixels)>;
+
+    // every copy takes numTextures textures of the size at once
+    ImageReadback(int width, int height, int numBuffers, int numTextures = 1);
+    ~ImageReadback();
+
+    ImageReadback(ImageReadback&) = delete;
+
+    // start copying the level 0 of the textures, false if it is dropped
+    bool read(const std::vector<GLuint>& textures, int tag);
+    // hand the copies that are done to the callback, or all of them if wait
+    void poll(const callback_t& cb, bool wait = false);
+
+    int pending() const { return m_count; }
+    int dropped() const { return m_dropped; }
+
+    // divide the sums of the samples by their count in alpha, the pixels
+    // without a sample are black
+    static std::vector<glm::vec3> resolve(const std::vector<glm::vec4>& sums);
+private:
+    int m_width;
+    int m_height;
+    int m_numTextures;
+    std::vector<GLuint> m_buffers;
+    std::vector<GLsync> m_fences;
+    std::vector<int> m_tags;
+    // the oldest copy and the number of copies in flight
+    int m_head;
+    int m_count;
+    int m_dropped;
+};
+
+#endif // IMAGE_READBACK_H
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "application.h"
 #include "renderer.h"
+#include "cpurenderer.h"
+#include "benchmark.h"
+#include "scene.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -9,6 +12,54 @@ namespace po = boost::program_options;
 
 #include <exception>
 #include <iostream>
+#include <sstream>
+
+std::istream& operator >>(std::istream& in, Backend& backend)
+{
+    std::string input;
+    in >> input;
+    if (input == "gl") {
+        backend = Backend::OpenGL;
+    } else if (input == "cpu") {
+        backend = Backend::Cpu;
+    } else {
+        throw po::invalid_option_value("backend");
+    }
+    return in;
+}
+
+std::ostream& operator <<(std::ostream& out, Backend backend)
+{
+    if (backend == Backend::OpenGL) {
+        out << "gl";
+    } else if (backend == Backend::Cpu) {
+        out << "cpu";
+    }
+    return out;
+}
+
+std::istream& operator >>(std::istream& in, simd_isa& isa)
+{
+    std::string input;
+    in >> input;
+    if (input == "auto") {
+        isa = best_simd_isa();
+        return in;
+    }
+    for (auto i : { simd_isa::scalar, simd_isa::sse, simd_isa::avx2, simd_isa::avx512 }) {
+        if (input == simd_isa_name(i) && simd_isa_supported(i)) {
+            isa = i;
+            return in;
+        }
+    }
+    throw po::invalid_option_value("simd");
+}
+
+std::ostream& operator <<(std::ostream& out, simd_isa isa)
+{
+    out << simd_isa_name(isa);
+    return out;
+}
 
 std::istream& operator >>(std::istream& in, RenderMode& mode)
 {
@@ -87,6 +138,34 @@ std::ostream& operator <<(std::ostream& out, HitTest mode)
     return out;
 }
 
+std::istream& operator >>(std::istream& in, Integrator& integrator)
+{
+    std::string input;
+    in >> input;
+    if (input == "path" || input == "megakernel") {
+        integrator = Integrator::PathTracing;
+    } else if (input == "wavefront") {
+        integrator = Integrator::WavefrontPathTracing;
+    } else if (input == "ao") {
+        integrator = Integrator::AmbientOcclusion;
+    } else {
+        throw po::invalid_option_value("integrator");
+    }
+    return in;
+}
+
+std::ostream& operator <<(std::ostream& out, Integrator integrator)
+{
+    if (integrator == Integrator::PathTracing) {
+        out << "path";
+    } else if (integrator == Integrator::WavefrontPathTracing) {
+        out << "wavefront";
+    } else if (integrator == Integrator::AmbientOcclusion) {
+        out << "ao";
+    }
+    return out;
+}
+
 std::istream& operator >>(std::istream& in, ShaderType& mode)
 {
     std::string input;
@@ -111,23 +190,162 @@ std::ostream& operator <<(std::ostream& out, ShaderType mode)
     return out;
 }
 
+std::istream& operator >>(std::istream& in, bvh_builder& builder)
+{
+    std::string input;
+    in >> input;
+    if (input == "sah") {
+        builder = bvh_builder::sah;
+    } else if (input == "lbvh") {
+        builder = bvh_builder::lbvh;
+    } else if (input == "hybrid") {
+        builder = bvh_builder::hybrid;
+    } else {
+        throw po::invalid_option_value("bvh builder");
+    }
+    return in;
+}
+
+std::ostream& operator <<(std::ostream& out, bvh_builder builder)
+{
+    if (builder == bvh_builder::sah) {
+        out << "sah";
+    } else if (builder == bvh_builder::lbvh) {
+        out << "lbvh";
+    } else if (builder == bvh_builder::hybrid) {
+        out << "hybrid";
+    }
+    return out;
+}
+
+std::istream& operator >>(std::istream& in, TileOrder& order)
+{
+    std::string input;
+    in >> input;
+    if (input == "raster") {
+        order = TileOrder::Raster;
+    } else if (input == "spiral") {
+        order = TileOrder::Spiral;
+    } else if (input == "hilbert") {
+        order = TileOrder::Hilbert;
+    } else if (input == "cost") {
+        order = TileOrder::Cost;
+    } else {
+        throw po::invalid_option_value("tile order");
+    }
+    return in;
+}
+
+std::ostream& operator <<(std::ostream& out, TileOrder order)
+{
+    if (order == TileOrder::Raster) {
+        out << "raster";
+    } else if (order == TileOrder::Spiral) {
+        out << "spiral";
+    } else if (order == TileOrder::Hilbert) {
+        out << "hilbert";
+    } else if (order == TileOrder::Cost) {
+        out << "cost";
+    }
+    return out;
+}
+
+// the percentages of diffuse, metal and dielectric spheres, e.g. 80/15/5
+std::istream& operator >>(std::istream& in, MaterialMix& mix)
+{
+    std::string input;
+    in >> input;
+    float diffuse, metal, dielectric;
+    char sep0, sep1;
+    std::istringstream ss(input);
+    if (!(ss >> diffuse >> sep0 >> metal >> sep1 >> dielectric) || sep0 != '/' || sep1 != '/' || !ss.eof() ||
+        diffuse < 0 || metal < 0 || dielectric < 0 || diffuse + metal + dielectric <= 0) {
+        throw po::invalid_option_value("materials");
+    }
+    float sum = diffuse + metal + dielectric;
+    mix.diffuse = diffuse / sum;
+    mix.metal = metal / sum;
+    mix.dielectric = dielectric / sum;
+    return in;
+}
+
+std::ostream& operator <<(std::ostream& out, const MaterialMix& mix)
+{
+    out << mix.diffuse * 100 << "/" << mix.metal * 100 << "/" << mix.dielectric * 100;
+    return out;
+}
+
 bool parseRenderConfig(int argc, char* argv[], RenderConfig& config)
 {
     po::options_description desc;
     desc.add_options()
         ("help,h", "help message")
+        ("backend", po::value<Backend>(&config.backend)->default_value(Backend::OpenGL), "renderer backend (gl, cpu)")
+        ("output,o", po::value<std::string>(&config.output)->default_value("render.ppm"), "the image the cpu backend and the headless mode write, .png, .pfm or .ppm")
+        ("simd", po::value<simd_isa>(&config.simdIsa)->default_value(best_simd_isa()), "simd instruction set of the cpu backend (auto, scalar, sse, avx2, avx512)")
         ("render", po::value<RenderMode>(&config.renderMode)->default_value(RenderMode::FullScreenIncremental), "render mode")
         ("shader", po::value<ShaderType>(&config.shaderType)->default_value(ShaderType::FragmentShader), "shader type")
         ("input", po::value<ShaderInput>(&config.shaderInput)->default_value(ShaderInput::UniformBuffer), "shader input source")
         ("hit-test", po::value<HitTest>(&config.hitTest)->default_value(HitTest::BVH), "hit test method")
+        ("integrator", po::value<Integrator>(&config.integrator)->default_value(Integrator::PathTracing), "integrator (path or megakernel, wavefront, ao)")
+        ("bvh-builder", po::value<bvh_builder>(&config.bvhBuilder)->default_value(bvh_builder::sah), "bvh builder (sah, lbvh, hybrid)")
+        ("bvh-width", po::value<int>(&config.bvhWidth)->default_value(2), "bvh node width (2, 4, 8)")
+        ("compress-nodes", po::bool_switch(&config.compressNodes)->default_value(false), "quantize the bvh child bounds to 8 bits")
+        ("skip-links", po::bool_switch(&config.skipLinks)->default_value(false), "traverse the bvh without a stack")
+        ("samples", po::value<int>(&config.numSamples)->default_value(DefaultNumSamples), "samples per pixel, 0 renders the fullscreen mode until the window is closed")
+        ("grid-size", po::value<int>(&config.gridSize)->default_value(DefaultGridSize), "half width of the sphere grid")
+        ("materials", po::value<MaterialMix>(&config.materialMix)->default_value(MaterialMix()), "percentages of diffuse/metal/dielectric small spheres")
+        ("sort-materials", po::bool_switch(&config.sortMaterials)->default_value(false), "shade the hits grouped by material (cpu, wavefront)")
         ("debug,d", po::bool_switch(&config.debugEnabled)->default_value(false), "debug bvh hit test")
+        ("target-frame-ms", po::value<float>(&config.targetFrameMs)->default_value(0), "scale the samples or tiles per frame to this gpu frame time, e.g. 16 interactive or 250 batch, 0 for one per frame")
+        ("noise-threshold", po::value<float>(&config.noiseThreshold)->default_value(0), "sample each pixel until its noise relative to its luminance is below this, e.g. 0.02, 0 for uniform sampling")
+        ("tile-size", po::value<int>(&config.tileSize)->default_value(0), "tile size of the blocked render mode and the cpu backend, 0 for 64 and 16")
+        ("tile-order", po::value<TileOrder>(&config.tileOrder)->default_value(TileOrder::Spiral), "tile order from the center (raster, spiral, hilbert), or cost for the most expensive tiles of --tile-costs first")
+        ("tile-costs", po::value<std::string>(&config.tileCosts), "a csv of tile costs saved by --save-tile-costs")
+        ("save-tile-costs", po::value<std::vector<std::string>>(&config.saveTileCosts)->composing(), "write the measured tile costs, as a heatmap to a .ppm path and as csv otherwise")
+        ("headless", po::bool_switch(&config.headless)->default_value(false), "render offscreen with egl, write --output and exit")
+        ("snapshot-every", po::value<int>(&config.snapshotEvery)->default_value(0), "copy the gl image to the cpu every this many samples, or tiles if blocked, 0 for none")
+        ("snapshot", po::value<std::string>(&config.snapshotPath), "write the snapshots next to this path, e.g. snap.png to snap_0010.png")
+        ("checkpoint", po::value<std::string>(&config.checkpointPath), "write the accumulated samples to this file to resume from")
+        ("checkpoint-every", po::value<int>(&config.checkpointEvery)->default_value(0), "write a checkpoint every this many samples, or tiles on the cpu, and at the end, 0 for none")
+        ("resume", po::value<std::string>(&config.resumePath), "continue the render from a checkpoint")
+        ("frames-in-flight", po::value<int>(&config.framesInFlight)->default_value(2), "frames issued ahead of the gpu before waiting for the oldest")
+        ("shader-cache", po::value<std::string>(&config.shaderCache), "keep the linked gl programs in this directory and load them from there, none by default")
         ("width", po::value<int>(&config.width)->default_value(800), "window width")
         ("height", po::value<int>(&config.height)->default_value(600), "window height")
+        ("bench", po::value<std::string>(&config.benchmark), "run a cpu benchmark and exit (bvh, bvh-scaling, bvh-builders, bvh-memory, bvh-nodes, bvh-traversal, bvh-occlusion, bvh-packets, bvh-bounces, bvh-leaves)")
     ;
     po::variables_map vm;
     try {
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);
+        if (config.bvhWidth != 2 && config.bvhWidth != 4 && config.bvhWidth != 8) {
+            throw po::invalid_option_value("bvh width");
+        }
+        if (config.framesInFlight < 1) {
+            throw po::invalid_option_value("frames in flight");
+        }
+        if (config.numSamples < 0 || (config.numSamples == 0 && config.backend == Backend::Cpu)) {
+            throw po::invalid_option_value("samples");
+        }
+        if (config.snapshotEvery < 0) {
+            throw po::invalid_option_value("snapshot every");
+        }
+        if (config.snapshotEvery > 0 && config.snapshotPath.empty()) {
+            throw po::required_option("snapshot");
+        }
+        if (config.checkpointEvery < 0) {
+            throw po::invalid_option_value("checkpoint every");
+        }
+        if (config.checkpointEvery > 0 && config.checkpointPath.empty()) {
+            throw po::required_option("checkpoint");
+        }
+        if (config.tileSize < 0) {
+            throw po::invalid_option_value("tile size");
+        }
+        if (config.tileOrder == TileOrder::Cost && config.tileCosts.empty()) {
+            throw po::required_option("tile-costs");
+        }
     } catch (const po::error& e) {
         std::cerr << e.what() << "\n";
         return false;
@@ -147,9 +365,23 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (!config.benchmark.empty()) {
+        if (!runBenchmark(config.benchmark)) {
+            std::cerr << "unknown benchmark: " << config.benchmark << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
     try {
-        Application app(config);
-        app.run();
+        if (config.backend == Backend::Cpu) {
+            CpuRenderer renderer(config);
+            renderer.render();
+            renderer.save(config.output);
+        } else {
+            Application app(config);
+            app.run();
+        }
         return 0;
     } catch (const std::exception& e) {
         std::cerr << e.what() << "\n";
@@ -0,0 +1,30 @@
+#ifndef RAY_H
+#define RAY_H
+
+#pragma once
+
+#include "aabb.h"
+#include <glm/glm.hpp>
+
+struct ray
+{
+    glm::vec3 origin;
+    glm::vec3 dir;
+};
+
+// slab test of the ray against the volume within [tmin, tmax], tnear is the
+// distance the ray enters the volume
+inline bool intersect(const ray& r, const glm::vec3& inv_dir, const aabb3& volume,
+                      float tmin, float tmax, float& tnear)
+{
+    for (int i = 0; i < 3; ++i) {
+        float t0 = (volume.min[i] - r.origin[i]) * inv_dir[i];
+        float t1 = (volume.max[i] - r.origin[i]) * inv_dir[i];
+        tmin = std::max(tmin, std::min(t0, t1));
+        tmax = std::min(tmax, std::max(t0, t1));
+    }
+    tnear = tmin;
+    return tmin < tmax;
+}
+
+#endif // RAY_H
\ No newline at end of file
@@ -4,11 +4,22 @@
 #include "uborenderinput.h"
 #include "texrenderinput.h"
 #include "ssborenderinput.h"
+#include "camera.h"
+#include "wavefronttracer.h"
+#include "framebudget.h"
+#include "gputimer.h"
+#include "tilecosts.h"
+#include "imagereadback.h"
+#include "checkpoint.h"
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
 
 //#define BLOCK_REFINE
@@ -20,21 +31,56 @@ namespace
 {
 
 constexpr int KernelSize = 16;
+// the largest traversal stack the shader may allocate per invocation
+constexpr int MaxStackSize = 64;
+constexpr int DefaultTileSize = 64;
+// the tiles or frames in flight that are timed
+constexpr int NumTimedDispatches = 64;
+// the samples a pixel takes before adaptive sampling trusts its variance
+constexpr int MinAdaptiveSamples = 8;
+// the sample count of a render without an end, the samples run until the
+// window is closed or adaptive sampling converges
+constexpr int OpenEndedSamples = std::numeric_limits<int>::max();
+// the most samples a frame traces, the converged pixels of adaptive sampling
+// make the samples of the others look cheap to the frame budget
+constexpr int MaxSamplesPerFrame = 256;
+// the snapshots copied to the cpu at the same time
+constexpr int NumSnapshotBuffers = 2;
+// the copies of the converged count in flight, one per frame
+constexpr int NumConvergedCopies = 4;
+
+// the image units and buffer bindings of the adaptive sampling in raytracing.fs
+constexpr GLuint MomentsImageUnit = 1;
+constexpr GLuint ConvergedBinding = 8;
 
 }
 
 Renderer::Renderer(const RenderConfig& config)
     : m_prog()
     , m_quad()
-    , m_fbo(0)
     , m_renderInput()
-    , m_windowOrigin(0)
-    , m_windowSize(64, 64)
+    , m_tilesLeft(0)
+    , m_timedDispatches(0)
+    , m_dispatchMs(0)
+    , m_maxDispatchMs(0)
+    , m_maxDispatchSample(0)
+    , m_fbo(0)
+    , m_momentsTex(0)
+    , m_convergedBuffer(0)
+    , m_convergedHead(0)
+    , m_convergedCount(0)
+    , m_allConverged(false)
     , m_curIter(0)
     , m_iterNum(1)
-    , m_numSamples(100)
-    , m_timeQuery(0)
+    , m_numSamples(DefaultNumSamples)
+    , m_timeQueries{}
     , m_queryEnded(false)
+    , m_snapshotEvery(0)
+    , m_snapshotProgress(0)
+    , m_checkpointEvery(0)
+    , m_checkpointProgress(0)
+    , m_sceneHash(0)
+    , m_resumedRays(0)
 {
     init(config);
 }
@@ -43,78 +89,193 @@ Renderer::~Renderer()
 {
     glDeleteFramebuffers(1, &m_fbo);
     glDeleteTextures(1, &m_colorTex);
-    glDeleteQueries(1, &m_timeQuery);
+    glDeleteTextures(1, &m_momentsTex);
+    glDeleteBuffers(1, &m_convergedBuffer);
+    for (GLsync fence : m_convergedFences) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    glDeleteBuffers((GLsizei)m_convergedCopies.size(), m_convergedCopies.data());
+    glDeleteQueries(2, m_timeQueries);
 }
 
 void Renderer::init(const RenderConfig& config)
 {
     m_width = config.width;
     m_height = config.height;
+    m_numSamples = config.numSamples > 0 ? config.numSamples : OpenEndedSamples;
 
-    m_prog = std::make_unique<GLSLProgram>();
     m_quad = std::make_unique<FullScreenQuad>();
 
     m_renderMode = config.renderMode;
     m_shaderType = config.shaderType;
 
+    // the defines the programs tracing the scene share
+    std::vector<std::string> defines;
+    int version = 0;
     if (config.renderMode == RenderMode::Blocked) {
-        m_prog->define("BLOCK_REFINE");
+        defines.push_back("BLOCK_REFINE");
     }
     if (config.debugEnabled) {
-        m_prog->define("DEBUG_BVH_HITS");
+        defines.push_back("DEBUG_BVH_HITS");
     }
     if (config.hitTest == HitTest::BruteForce) {
-        m_prog->define("BRUTE_FORCE_HIT_TEST");
+        defines.push_back("BRUTE_FORCE_HIT_TEST");
+    }
+    if (config.integrator == Integrator::AmbientOcclusion) {
+        defines.push_back("AMBIENT_OCCLUSION");
+    }
+    if (config.integrator == Integrator::WavefrontPathTracing) {
+        if (config.shaderType != ShaderType::ComputeShader || config.renderMode != RenderMode::FullScreenIncremental ||
+            config.debugEnabled) {
+            throw std::runtime_error("the wavefront integrator needs the compute shader and the fullscreen render mode");
+        }
+    } else if (config.sortMaterials) {
+        throw std::runtime_error("sorting the materials needs the wavefront integrator");
+    }
+    if (config.numSamples <= 0 && config.renderMode == RenderMode::Blocked) {
+        throw std::runtime_error("the blocked render mode needs a sample count");
+    }
+    if ((config.checkpointEvery > 0 || !config.resumePath.empty()) &&
+        config.renderMode != RenderMode::FullScreenIncremental) {
+        throw std::runtime_error("checkpoints need the fullscreen render mode");
+    }
+    if (config.noiseThreshold > 0) {
+        if (config.shaderType != ShaderType::ComputeShader || config.renderMode != RenderMode::FullScreenIncremental ||
+            config.debugEnabled) {
+            throw std::runtime_error("adaptive sampling needs the compute shader and the fullscreen render mode");
+        }
+        defines.push_back("ADAPTIVE_SAMPLING");
+    }
+    if (config.bvhWidth > 2) {
+        if (config.shaderInput == ShaderInput::UniformBuffer) {
+            throw std::runtime_error("wide bvh nodes need texture or ssbo input");
+        }
+        defines.push_back("BVH_WIDTH " + std::to_string(config.bvhWidth));
+    }
+    if (config.compressNodes) {
+        if (config.shaderInput == ShaderInput::UniformBuffer || config.bvhWidth > 2) {
+            throw std::runtime_error("compressed bvh nodes need a binary bvh with texture or ssbo input");
+        }
+        defines.push_back("COMPRESSED_NODES");
+    }
+    if (config.skipLinks) {
+        if (config.shaderInput == ShaderInput::UniformBuffer || config.bvhWidth > 2 || config.compressNodes) {
+            throw std::runtime_error("skip links need an uncompressed binary bvh with texture or ssbo input");
+        }
+        defines.push_back("SKIP_LINKS");
     }
     if (config.shaderInput == ShaderInput::UniformBuffer) {
-        m_prog->define("UBO_INPUT");
+        defines.push_back("UBO_INPUT");
     } else if (config.shaderInput == ShaderInput::ShaderStorageBuffer) {
-        m_prog->overrideVersion(430);
-        m_prog->define("SSBO_INPUT");
+        version = 430;
+        defines.push_back("SSBO_INPUT");
     } else {
-        m_prog->define("TEXTURE_INPUT");
+        defines.push_back("TEXTURE_INPUT");
     }
-    if (config.shaderType == ShaderType::FragmentShader) {
-        m_prog->define("FRAGMENT_SHADER");
-        m_prog->compileShader("shader/passthru.vs");
-        m_prog->compileShader("shader/raytracing.fs");
+
+    // the traversal stack is sized for the tree, the nodes have to be
+    // uploaded before the shader is compiled
+    auto buildStart = std::chrono::steady_clock::now();
+    auto scene = createScene(config.gridSize, config.bvhBuilder, bvh_tree::default_max_leaf_size, config.materialMix);
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+    std::cout << "Scene Build Time: " << buildTime.count() << "ms\n";
+    m_sceneHash = sceneHash(scene.objects);
+    if (config.shaderInput == ShaderInput::UniformBuffer) {
+        m_renderInput = std::make_unique<UboRenderInput>(scene);
+    } else if (config.shaderInput == ShaderInput::Texture) {
+        m_renderInput = std::make_unique<TextureRenderInput>(scene, config.bvhWidth, config.compressNodes, config.skipLinks);
     } else {
-        m_prog->overrideVersion(430);
-        m_prog->define("COMPUTE_SHADER");
-        m_prog->define("KERNEL_SIZE " + std::to_string(KernelSize));
-        m_prog->compileShader("shader/raytracing.fs", GLSLShader::COMPUTE);
+        m_renderInput = std::make_unique<SsboRenderInput>(scene, config.bvhWidth, config.compressNodes, config.skipLinks);
+    }
+    if (m_renderInput->stackSize() > MaxStackSize) {
+        throw std::runtime_error("the bvh is too deep for the traversal stack");
+    }
+    defines.push_back("STACK_SIZE " + std::to_string(m_renderInput->stackSize()));
 
+    // a warm start loads the programs linked by a previous run
+    auto shaderStart = std::chrono::steady_clock::now();
+    int numPrograms = 0;
+    int numCached = 0;
+    auto linkProgram = [&](GLSLProgram& prog) {
+        prog.link();
+        ++numPrograms;
+        numCached += prog.isCached() ? 1 : 0;
+    };
+
+    auto createProgram = [&](const std::vector<std::string>& stageDefines) {
+        auto prog = std::make_unique<GLSLProgram>();
+        prog->cacheBinary(config.shaderCache);
+        for (const auto& def : defines) {
+            prog->define(def);
+        }
+        for (const auto& def : stageDefines) {
+            prog->define(def);
+        }
+        if (version) {
+            prog->overrideVersion(version);
+        }
+        if (config.shaderType == ShaderType::FragmentShader) {
+            prog->define("FRAGMENT_SHADER");
+            prog->compileShader("shader/passthru.vs");
+            prog->compileShader("shader/raytracing.fs");
+        } else {
+            prog->overrideVersion(430);
+            prog->define("COMPUTE_SHADER");
+            prog->define("KERNEL_SIZE " + std::to_string(KernelSize));
+            prog->compileShader("shader/raytracing.fs", GLSLShader::COMPUTE);
+        }
+
+        linkProgram(*prog);
+        prog->use();
+        GL_CHECK_ERROR;
+
+        auto camera = defaultCamera();
+        prog->setUniform("BackgroundColor", SkyColor);
+        prog->setUniform("CameraPos", camera.position);
+        prog->setUniform("CameraLookAt", camera.lookAt);
+        prog->setUniform("FocalLength", camera.focalLength);
+        prog->setUniform("FovY", camera.fovY);
+        prog->setUniform("ScreenSize", glm::vec2(config.width, config.height));
+        prog->setUniform("NumSamples", m_numSamples);
+        prog->setUniform("IterNum", m_iterNum);
+        if (config.noiseThreshold > 0) {
+            prog->setUniform("NoiseThreshold", config.noiseThreshold);
+            prog->setUniform("MinSamples", MinAdaptiveSamples);
+        }
+        GL_CHECK_ERROR;
+
+        m_renderInput->setInput(*prog);
+        prog->setUniform("NumSpheres", (int)scene.objects.size());
+        return prog;
+    };
+    if (config.integrator == Integrator::WavefrontPathTracing) {
+        m_wavefront = std::make_unique<WavefrontTracer>(m_width, m_height, config.sortMaterials, createProgram);
+    } else {
+        m_prog = createProgram({});
+    }
+
+    if (config.renderMode == RenderMode::FullScreenIncremental) {
+        m_renderTexProg = std::make_unique<GLSLProgram>();
+        m_renderTexProg->cacheBinary(config.shaderCache);
+        m_renderTexProg->compileShader("shader/passthru.vs");
+        m_renderTexProg->compileShader("shader/resolve.fs");
+        linkProgram(*m_renderTexProg);
+        m_renderTexProg->use();
+        m_renderTexProg->setUniform("MainTex", 0);
+    } else if (config.shaderType == ShaderType::ComputeShader) {
         m_renderTexProg = std::make_unique<GLSLProgram>();
+        m_renderTexProg->cacheBinary(config.shaderCache);
         m_renderTexProg->compileShader("shader/passthru.vs");
         m_renderTexProg->compileShader("shader/texcolor.fs");
-        m_renderTexProg->link();
+        linkProgram(*m_renderTexProg);
         m_renderTexProg->use();
         m_renderTexProg->setUniform("MainTex", 0);
     }
-
-    m_prog->link();
-    m_prog->use();
-    GL_CHECK_ERROR;
-
-    m_prog->setUniform("BackgroundColor", glm::vec3(0.5f, 0.7f, 1.0f));
-    m_prog->setUniform("CameraPos", glm::vec3(13, 2, 3));
-    m_prog->setUniform("CameraLookAt", glm::vec3(0));
-    m_prog->setUniform("FocalLength", 1.0f);
-    m_prog->setUniform("FovY", glm::radians(60.0f));
-    m_prog->setUniform("ScreenSize", glm::vec2(config.width, config.height));
-    m_prog->setUniform("NumSamples", m_numSamples);
-    GL_CHECK_ERROR;
-
-    auto scene = createScene();
-    if (config.shaderInput == ShaderInput::UniformBuffer) {
-        m_renderInput = std::make_unique<UboRenderInput>(scene);
-    } else if (config.shaderInput == ShaderInput::Texture) {
-        m_renderInput = std::make_unique<TextureRenderInput>(scene);
-    } else {
-        m_renderInput = std::make_unique<SsboRenderInput>(scene);
-    }
-    m_renderInput->setInput(*m_prog);
-    m_prog->setUniform("NumSpheres", (int)scene.objects.size());
+    std::chrono::duration<double, std::milli> shaderTime = std::chrono::steady_clock::now() - shaderStart;
+    std::cout << "Shader Build Time: " << shaderTime.count() << "ms, " << numCached << " of "
+              << numPrograms << " programs cached\n";
 
     glGenTextures(1, &m_colorTex);
     glBindTexture(GL_TEXTURE_2D, m_colorTex);
@@ -124,8 +285,9 @@ void Renderer::init(const RenderConfig& config)
         texFormat = GL_RGBA8;
         size = 4;
     } else {
-        texFormat = GL_RGBA16;
-        size = 8;
+        // the sums of the samples, unclamped, and their count in alpha
+        texFormat = GL_RGBA32F;
+        size = 16;
     }
     size *= m_width * m_height;
     std::vector<char> buf(size);
@@ -143,81 +305,215 @@ void Renderer::init(const RenderConfig& config)
         glBindImageTexture(0, m_colorTex, 0, GL_FALSE, 0, GL_READ_WRITE, texFormat);
     }
 
-    m_prog->setUniform("IterNum", m_iterNum);
-    if (config.renderMode == RenderMode::FullScreenIncremental &&
-        config.shaderType == ShaderType::FragmentShader) {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE);
+    if (config.noiseThreshold > 0) {
+        std::vector<float> moments(4 * m_width * m_height, 0.0f);
+        glGenTextures(1, &m_momentsTex);
+        glBindTexture(GL_TEXTURE_2D, m_momentsTex);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, m_width, m_height);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, moments.data());
+        glBindImageTexture(MomentsImageUnit, m_momentsTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+        GLuint converged = 0;
+        glGenBuffers(1, &m_convergedBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_convergedBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(converged), &converged, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ConvergedBinding, m_convergedBuffer);
+
+        m_convergedCopies.resize(NumConvergedCopies);
+        m_convergedFences.resize(NumConvergedCopies, nullptr);
+        glGenBuffers(NumConvergedCopies, m_convergedCopies.data());
+        for (GLuint copy : m_convergedCopies) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+            glBufferData(GL_COPY_WRITE_BUFFER, sizeof(converged), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        GL_CHECK_ERROR;
     }
 
-    glGenQueries(1, &m_timeQuery);
-    glBeginQuery(GL_TIME_ELAPSED, m_timeQuery);
+    if (config.renderMode == RenderMode::Blocked) {
+        int tileSize = config.tileSize > 0 ? config.tileSize : DefaultTileSize;
+        std::unique_ptr<TileCosts> costs;
+        if (!config.tileCosts.empty()) {
+            costs = std::make_unique<TileCosts>(config.tileCosts);
+        }
+        m_tiles = std::make_unique<TileScheduler>(m_width, m_height, tileSize, config.tileOrder, 1, costs.get());
+        m_tilesLeft = m_tiles->numTiles();
+        m_tileCosts = std::make_unique<TileCosts>(m_width, m_height);
+        m_saveTileCosts = config.saveTileCosts;
+        if (config.targetFrameMs > 0) {
+            // the work is counted in pixels, a frame takes at least a tile
+            m_frameBudget = std::make_unique<FrameBudget>("pixels", config.targetFrameMs, tileSize * tileSize,
+                                                          m_width * m_height);
+        }
+    } else if (config.targetFrameMs > 0) {
+        m_frameBudget = std::make_unique<FrameBudget>("samples", config.targetFrameMs, 1,
+                                                      std::min(m_numSamples, MaxSamplesPerFrame));
+    }
+
+    m_gpuTimer = std::make_unique<GpuTimer>(NumTimedDispatches);
+    if (config.snapshotEvery > 0) {
+        m_snapshotReadback = std::make_unique<ImageReadback>(m_width, m_height, NumSnapshotBuffers);
+        m_snapshotEvery = config.snapshotEvery;
+    }
+    if (config.checkpointEvery > 0) {
+        m_checkpointReadback = std::make_unique<ImageReadback>(m_width, m_height, NumSnapshotBuffers,
+                                                               m_momentsTex ? 2 : 1);
+        m_checkpointEvery = config.checkpointEvery;
+    }
+    if (!config.resumePath.empty()) {
+        resume(Checkpoint(config.resumePath));
+    }
+
+    // timestamps rather than an elapsed time query, which cannot overlap
+    // the timing of the frames
+    glGenQueries(2, m_timeQueries);
+    glQueryCounter(m_timeQueries[0], GL_TIMESTAMP);
+    if (m_renderMode == RenderMode::FullScreenIncremental && m_curIter >= m_numSamples) {
+        // resumed from a complete render
+        glQueryCounter(m_timeQueries[1], GL_TIMESTAMP);
+        m_queryEnded = true;
+    }
+}
+
+void Renderer::resume(const Checkpoint& checkpoint)
+{
+    checkpoint.check(m_width, m_height, m_sceneHash);
+    // the samples of the frames are seeded alike for all the pixels
+    if (checkpoint.tiled) {
+        throw std::runtime_error("the checkpoint is of an unfinished cpu render, only the cpu backend resumes it");
+    }
+    glBindTexture(GL_TEXTURE_2D, m_colorTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, checkpoint.sums.data());
+    if (m_momentsTex) {
+        if (checkpoint.moments.empty()) {
+            throw std::runtime_error("the checkpoint was not sampled adaptively");
+        }
+        glBindTexture(GL_TEXTURE_2D, m_momentsTex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_FLOAT, checkpoint.moments.data());
+        GLuint converged = 0;
+        for (const auto& moments : checkpoint.moments) {
+            converged += moments.w != 0 ? 1 : 0;
+            m_resumedRays += moments.z;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_convergedBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(converged), &converged);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    GL_CHECK_ERROR;
+
+    m_curIter = std::min(checkpoint.samples, m_numSamples);
+    m_iterNum = checkpoint.iterNum;
+    if (!m_momentsTex) {
+        m_resumedRays = (double)m_width * m_height * m_curIter;
+    }
+    // the samples already taken are not copied again
+    m_snapshotProgress = m_curIter;
+    m_checkpointProgress = m_curIter;
+    std::cout << "Resumed: " << m_curIter << " samples\n";
 }
 
 void Renderer::render()
 {
+    collectTimings();
+    pollReadbacks(false);
     if (m_renderMode == RenderMode::Blocked) {
-        if (m_windowOrigin.y < m_height) {
+        if (m_tilesLeft > 0) {
             if (m_fbo) {
                 glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
             }
-            auto size = glm::vec2(m_width, m_height);
-            auto rightTop = glm::min(m_windowOrigin + m_windowSize, size);
-            m_prog->use();
-            m_prog->setUniform("Window", glm::vec4(m_windowOrigin, rightTop));
-            if (m_shaderType == ShaderType::FragmentShader) {
-                auto model = glm::translate(glm::mat4(1.0f), glm::vec3((m_windowOrigin + rightTop) * 0.5f, 0));
-                auto size = rightTop - m_windowOrigin;
-                model = glm::scale(model, glm::vec3(size / 2.0f, 1));
-                auto view = glm::ortho(0.0f, (float)m_width, 0.0f, (float)m_height);
-
-                m_prog->setUniform("MVP", view * model);
-                m_quad->render();
-            } else {
-                glDispatchCompute((int)m_windowSize.x / KernelSize, (int)m_windowSize.y / KernelSize, 1);
+            if (m_frameBudget) {
+                m_frameBudget->beginFrame();
             }
-
-            m_windowOrigin.x += m_windowSize.x;
-            if (m_windowOrigin.x >= m_width) {
-                m_windowOrigin.x = 0;
-                m_windowOrigin.y += m_windowSize.y;
+            int budget = m_frameBudget ? m_frameBudget->work() : 0;
+            int tileArea = m_tiles->tileSize() * m_tiles->tileSize();
+            int pixels = 0;
+            Tile tile;
+            // at least a tile, and no more than fit the budget
+            while ((pixels == 0 || pixels + tileArea <= budget) && m_tiles->next(0, tile)) {
+                m_gpuTimer->begin();
+                renderTile(tile);
+                m_gpuTimer->end((int)m_renderedTiles.size());
+                m_renderedTiles.push_back(tile);
+                pixels += tile.area();
+                --m_tilesLeft;
+            }
+            if (m_frameBudget) {
+                m_frameBudget->endFrame(pixels);
             }
 
-            if (m_windowOrigin.y >= m_height) {
-                glEndQuery(GL_TIME_ELAPSED);
+            if (m_tilesLeft == 0) {
+                glQueryCounter(m_timeQueries[1], GL_TIMESTAMP);
                 m_queryEnded = true;
             }
         }
     } else {
+        // the count is copied after every frame and read once the copy is
+        // done, the frames in flight are not waited for. The frames issued
+        // after the last pixel converged still run, but they skip every pixel
+        if (m_convergedBuffer && m_curIter < m_numSamples && allPixelsConverged()) {
+            m_curIter = m_numSamples;
+            glQueryCounter(m_timeQueries[1], GL_TIMESTAMP);
+            m_queryEnded = true;
+        }
         if (m_curIter < m_numSamples) {
             if (m_fbo) { 
                 glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
             }
-            m_prog->use();
-            m_prog->setUniform("IterStart", m_curIter);
-            m_curIter += m_iterNum;
-            if (m_shaderType == ShaderType::FragmentShader) {
-                m_prog->setUniform("MVP", glm::mat4(1.0f));
-                m_quad->render();
+            if (m_frameBudget) {
+                m_frameBudget->beginFrame();
+                m_iterNum = std::min(m_frameBudget->work(), m_numSamples - m_curIter);
+            }
+            m_gpuTimer->begin();
+            int sample = m_curIter;
+            if (m_wavefront) {
+                // the kernels trace one sample at a time
+                for (int i = 0; i < m_iterNum && m_curIter < m_numSamples; ++i) {
+                    m_wavefront->render(m_curIter);
+                    ++m_curIter;
+                }
             } else {
-                glDispatchCompute((m_width + KernelSize - 1) / KernelSize, 
-                                  (m_height + KernelSize - 1) / KernelSize, 
-                                  1);
+                m_prog->use();
+                m_prog->setUniform("IterStart", m_curIter);
+                m_prog->setUniform("IterNum", m_iterNum);
+                m_curIter += m_iterNum;
+                if (m_shaderType == ShaderType::FragmentShader) {
+                    // add the samples to the sums
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_ONE, GL_ONE);
+                    m_prog->setUniform("MVP", glm::mat4(1.0f));
+                    m_quad->render();
+                    glDisable(GL_BLEND);
+                } else {
+                    glDispatchCompute((m_width + KernelSize - 1) / KernelSize, 
+                                      (m_height + KernelSize - 1) / KernelSize, 
+                                      1);
+                }
+            }
+            m_gpuTimer->end(sample);
+            if (m_frameBudget) {
+                m_frameBudget->endFrame(m_iterNum);
+            }
+            if (m_convergedBuffer) {
+                copyConvergedCount();
             }
 
             if (m_curIter >= m_numSamples) {
-                glEndQuery(GL_TIME_ELAPSED);
+                glQueryCounter(m_timeQueries[1], GL_TIMESTAMP);
                 m_queryEnded = true;
             }
         }
     }
+    takeReadbacks();
     checkQueryEnd();
 
-    if (m_shaderType == ShaderType::FragmentShader) {
+    if (m_shaderType == ShaderType::FragmentShader && m_renderMode == RenderMode::Blocked) {
         glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
         glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
     } else {
+        // the fullscreen render mode resolves the sums into the colors
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
         m_renderTexProg->use();
         glActiveTexture(GL_TEXTURE0);
@@ -227,17 +523,161 @@ void Renderer::render()
     }
 }
 
+void Renderer::renderTile(const Tile& tile)
+{
+    glm::vec2 leftBottom(tile.x0, tile.y0);
+    glm::vec2 rightTop(tile.x1, tile.y1);
+    m_prog->use();
+    m_prog->setUniform("Window", glm::vec4(leftBottom, rightTop));
+    if (m_shaderType == ShaderType::FragmentShader) {
+        auto model = glm::translate(glm::mat4(1.0f), glm::vec3((leftBottom + rightTop) * 0.5f, 0));
+        auto size = rightTop - leftBottom;
+        model = glm::scale(model, glm::vec3(size / 2.0f, 1));
+        auto view = glm::ortho(0.0f, (float)m_width, 0.0f, (float)m_height);
+
+        m_prog->setUniform("MVP", view * model);
+        m_quad->render();
+    } else {
+        // the shader skips the invocations past the tile
+        glDispatchCompute((tile.x1 - tile.x0 + KernelSize - 1) / KernelSize,
+                          (tile.y1 - tile.y0 + KernelSize - 1) / KernelSize, 1);
+    }
+}
+
+void Renderer::takeReadbacks(bool force)
+{
+    int progress, total;
+    if (m_tiles) {
+        total = m_tiles->numTiles();
+        progress = total - m_tilesLeft;
+    } else {
+        total = m_numSamples;
+        progress = std::min(m_curIter, m_numSamples);
+    }
+    if (m_snapshotReadback) {
+        takeReadback(*m_snapshotReadback, { m_colorTex }, progress, total, m_snapshotEvery, m_snapshotProgress,
+                     force);
+    }
+    if (m_checkpointReadback) {
+        if (takeReadback(*m_checkpointReadback, { m_colorTex, m_momentsTex }, progress, total, m_checkpointEvery,
+                         m_checkpointProgress, force)) {
+            // the frame budget changes m_iterNum before the copy is done
+            m_checkpointIterNums.push_back(m_iterNum);
+        }
+    }
+}
+
+bool Renderer::takeReadback(ImageReadback& readback, const std::vector<GLuint>& textures, int progress, int total,
+                            int every, int& lastProgress, bool force)
+{
+    if (progress == lastProgress) {
+        return false;
+    }
+    if (progress == total || force) {
+        // the final image is taken once the readback has a free buffer
+        if (readback.read(textures, progress)) {
+            lastProgress = progress;
+            return true;
+        }
+        return false;
+    } else if (progress / every > lastProgress / every) {
+        lastProgress = progress;
+        return readback.read(textures, progress);
+    }
+    return false;
+}
+
+void Renderer::pollReadbacks(bool wait)
+{
+    if (m_snapshotReadback) {
+        m_snapshotReadback->poll([&](int progress, std::vector<glm::vec4> sums) {
+            if (m_onSnapshot) {
+                m_onSnapshot(progress, ImageReadback::resolve(sums));
+            }
+        }, wait);
+    }
+    if (m_checkpointReadback) {
+        m_checkpointReadback->poll([&](int progress, std::vector<glm::vec4> pixels) {
+            int iterNum = m_checkpointIterNums.front();
+            m_checkpointIterNums.pop_front();
+            if (!m_onCheckpoint) {
+                return;
+            }
+            Checkpoint checkpoint;
+            checkpoint.width = m_width;
+            checkpoint.height = m_height;
+            checkpoint.samples = progress;
+            checkpoint.iterNum = iterNum;
+            checkpoint.sceneHash = m_sceneHash;
+            size_t numPixels = size_t(m_width) * m_height;
+            if (pixels.size() > numPixels) {
+                checkpoint.moments.assign(pixels.begin() + numPixels, pixels.end());
+                pixels.resize(numPixels);
+            }
+            checkpoint.sums = std::move(pixels);
+            m_onCheckpoint(std::move(checkpoint));
+        }, wait);
+    }
+}
+
+void Renderer::collectTimings()
+{
+    int tag;
+    double ms;
+    while (m_gpuTimer->poll(tag, ms)) {
+        ++m_timedDispatches;
+        m_dispatchMs += ms;
+        if (ms > m_maxDispatchMs) {
+            m_maxDispatchMs = ms;
+            m_maxDispatchSample = tag;
+        }
+        if (m_tiles) {
+            m_tileCosts->add(m_renderedTiles[tag], ms);
+        }
+    }
+}
+
 void Renderer::checkQueryEnd()
 {
     if (m_queryEnded) {
         GLint ready;
-        glGetQueryObjectiv(m_timeQuery, GL_QUERY_RESULT_AVAILABLE, &ready);
+        glGetQueryObjectiv(m_timeQueries[1], GL_QUERY_RESULT_AVAILABLE, &ready);
         if (ready) {
-            GLint64 time;
-            glGetQueryObjecti64v(m_timeQuery, GL_QUERY_RESULT, &time);
+            GLint64 start, end;
+            glGetQueryObjecti64v(m_timeQueries[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjecti64v(m_timeQueries[1], GL_QUERY_RESULT, &end);
+            GLint64 time = end - start;
             std::cout << "Render Time: " << time / 1e9f << "s\n";
-            glDeleteQueries(1, &m_timeQuery);
-            m_timeQuery = 0;
+            double rays = (double)m_width * m_height * m_numSamples;
+            if (m_convergedBuffer) {
+                double uniform = rays;
+                rays = samplesTaken();
+                std::cout << "Samples: " << rays / m_width / m_height << " per pixel";
+                if (m_numSamples != OpenEndedSamples) {
+                    std::cout << ", " << rays / uniform * 100 << "% of uniform sampling";
+                }
+                std::cout << "\n";
+            }
+            // the samples of a resumed render are counted from where it resumed
+            std::cout << "Primary Rays: " << (rays - m_resumedRays) / (time / 1e9) / 1e6 << "M/s\n";
+            // the timestamps are written in order, the dispatches are done too
+            collectTimings();
+            if (m_timedDispatches) {
+                std::cout << (m_tiles ? "Tiles: " : "Frames: ") << m_timedDispatches << " timed, "
+                          << m_dispatchMs / m_timedDispatches << "ms on average, " << m_maxDispatchMs << "ms at most";
+                if (!m_tiles) {
+                    std::cout << " from sample " << m_maxDispatchSample;
+                }
+                std::cout << ", " << m_gpuTimer->dropped() << " not timed\n";
+            }
+            for (const auto& path : m_saveTileCosts) {
+                m_tileCosts->save(path);
+            }
+            if (m_frameBudget) {
+                m_frameBudget->report();
+            }
+            glDeleteQueries(2, m_timeQueries);
+            m_timeQueries[0] = m_timeQueries[1] = 0;
             m_queryEnded = false;
 
             if (m_onRenderComplete) {
@@ -247,6 +687,98 @@ void Renderer::checkQueryEnd()
     }
 }
 
+void Renderer::copyConvergedCount()
+{
+    // the next frame copies the count if all the copies are in flight
+    int capacity = (int)m_convergedCopies.size();
+    if (m_convergedCount == capacity) {
+        return;
+    }
+    int slot = (m_convergedHead + m_convergedCount) % capacity;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_convergedBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_convergedCopies[slot]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_convergedFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ++m_convergedCount;
+}
+
+bool Renderer::allPixelsConverged()
+{
+    // the copies are taken in order, the count only grows
+    while (!m_allConverged && m_convergedCount > 0) {
+        GLsync& fence = m_convergedFences[m_convergedHead];
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (result == GL_WAIT_FAILED) {
+            throw std::runtime_error("failed to wait for the converged count");
+        }
+        if (result == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+
+        GLuint converged;
+        glBindBuffer(GL_COPY_READ_BUFFER, m_convergedCopies[m_convergedHead]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(converged), &converged);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        m_allConverged = converged == GLuint(m_width * m_height);
+        m_convergedHead = (m_convergedHead + 1) % (int)m_convergedCopies.size();
+        --m_convergedCount;
+    }
+    return m_allConverged;
+}
+
+double Renderer::samplesTaken() const
+{
+    std::vector<float> moments(4 * m_width * m_height);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, m_momentsTex);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, moments.data());
+    double samples = 0;
+    for (size_t i = 2; i < moments.size(); i += 4) {
+        samples += moments[i];
+    }
+    return samples;
+}
+
+std::vector<glm::vec3> Renderer::readImage() const
+{
+    std::vector<glm::vec4> sums(m_width * m_height);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, m_colorTex);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, sums.data());
+    return ImageReadback::resolve(sums);
+}
+
+void Renderer::onSnapshot(const snapshot_t& cb)
+{
+    m_onSnapshot = cb;
+}
+
+void Renderer::onCheckpoint(const checkpoint_t& cb)
+{
+    m_onCheckpoint = cb;
+}
+
+void Renderer::finishReadbacks()
+{
+    // the final copies may not have found a free buffer yet, and a render
+    // stopped early is copied as far as it got
+    pollReadbacks(true);
+    takeReadbacks(true);
+    pollReadbacks(true);
+    if (m_snapshotReadback && m_snapshotReadback->dropped()) {
+        std::cout << "Snapshots: " << m_snapshotReadback->dropped() << " dropped\n";
+    }
+    if (m_checkpointReadback && m_checkpointReadback->dropped()) {
+        std::cout << "Checkpoints: " << m_checkpointReadback->dropped() << " dropped\n";
+    }
+}
+
 void Renderer::onRenderComplete(const renderComplete_t& cb)
 {
     m_onRenderComplete = cb;
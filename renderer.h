@@ -6,12 +6,26 @@
 #include "renderer.h"
 #include "glslprogram.h"
 #include "fullscreenquad.h"
+#include "bvh_node.h"
+#include "bvh_packet.h"
+#include "scene.h"
+#include "tilescheduler.h"
 
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <functional>
+#include <string>
+#include <vector>
 
 class RenderInput;
+class WavefrontTracer;
+class FrameBudget;
+class GpuTimer;
+class TileCosts;
+class ImageReadback;
+struct Checkpoint;
 
 enum RenderMode
 {
@@ -32,44 +46,164 @@ enum HitTest
     BVH
 };
 
+enum Integrator
+{
+    PathTracing,
+    // one occlusion ray per sample from the primary hit
+    AmbientOcclusion,
+    // PathTracing split into kernels that pass the paths through queues,
+    // compute shader only
+    WavefrontPathTracing
+};
+
+enum Backend
+{
+    OpenGL,
+    // path trace on the cpu threads, for the machines without a gpu
+    Cpu
+};
+
 enum ShaderType
 {
     FragmentShader,
     ComputeShader
 };
 
+// the samples per pixel of a full render
+constexpr int DefaultNumSamples = 100;
+
 struct RenderConfig
 {
+    Backend backend;
     int width;
     int height;
     ShaderType shaderType;
     RenderMode renderMode;
     ShaderInput shaderInput;
     HitTest hitTest;
+    Integrator integrator;
+    bvh_builder bvhBuilder;
+    // 2 keeps the binary bvh, 4 or 8 collapses it into wide nodes
+    int bvhWidth;
+    // quantize the child bounds of the binary bvh to 8 bits
+    bool compressNodes;
+    // traverse the binary bvh without a stack by following skip links
+    bool skipLinks;
+    int gridSize;
+    // the samples per pixel, 0 samples the fullscreen render mode until it is stopped
+    int numSamples;
+    // the materials of the small spheres
+    MaterialMix materialMix;
+    // shade the hits of a bounce grouped by material, wavefront and cpu only
+    bool sortMaterials;
     bool debugEnabled;
+    // the image the cpu backend and the headless mode write, a .png, a .pfm or a ppm
+    std::string output;
+    // the instruction set the cpu backend traces the primary rays with
+    simd_isa simdIsa;
+    // the gpu time of a frame the samples per frame of the fullscreen render
+    // mode, or the tiles per frame of the blocked one, are scaled to. 0
+    // traces one sample or one tile per frame
+    float targetFrameMs;
+    // the tiles of the blocked render mode and the cpu backend, 0 picks the
+    // default of the backend
+    int tileSize;
+    TileOrder tileOrder;
+    // the noise relative to the mean luminance a pixel is sampled down to,
+    // at most to NumSamples samples, 0 samples every pixel NumSamples times
+    float noiseThreshold;
+    // a csv of tile costs saved by a previous render for the cost tile order
+    std::string tileCosts;
+    // write the tile costs measured by the blocked render mode or the cpu
+    // backend, a .ppm path as a heatmap and anything else as csv
+    std::vector<std::string> saveTileCosts;
+    // render with an offscreen context and write output instead of opening a window
+    bool headless;
+    // copy the image to the cpu every this many samples, or tiles in the
+    // blocked render mode, and when the render completes. 0 for none
+    int snapshotEvery;
+    // the snapshots are written next to this path with the progress in the name
+    std::string snapshotPath;
+    // write a checkpoint to checkpointPath every this many samples and when
+    // the render completes, 0 for none. Fullscreen render mode only
+    int checkpointEvery;
+    std::string checkpointPath;
+    // a checkpoint to continue the render from
+    std::string resumePath;
+    // the frames the cpu issues ahead of the gpu before it waits, 1 waits
+    // for every frame before the next one
+    int framesInFlight;
+    // the directory of the linked gl programs, empty by default to compile them every run
+    std::string shaderCache;
+    // run the named cpu benchmark instead of rendering
+    std::string benchmark;
 };
 
 class Renderer
 {
 public:
     using renderComplete_t = std::function<void()>;
+    // the samples or the tiles rendered and the image, bottom row first
+    using snapshot_t = std::function<void(int progress, std::vector<glm::vec3> image)>;
+    using checkpoint_t = std::function<void(Checkpoint checkpoint)>;
 
     Renderer(const RenderConfig& config);
     ~Renderer();
 
     void onRenderComplete(const renderComplete_t& cb);
     void render();
+    // read back the image rendered so far, bottom row first
+    std::vector<glm::vec3> readImage() const;
+    // the snapshots and the checkpoints are handed over by render a few
+    // frames after they are taken
+    void onSnapshot(const snapshot_t& cb);
+    void onCheckpoint(const checkpoint_t& cb);
+    // wait for the snapshots and the checkpoints in flight and hand them over
+    void finishReadbacks();
 private:
     void init(const RenderConfig& config);
+    // continue from the samples of the checkpoint
+    void resume(const Checkpoint& checkpoint);
     void checkQueryEnd();
+    void renderTile(const Tile& tile);
+    // take the timings of the dispatches that are done
+    void collectTimings();
+    // start copying the image if a snapshot or a checkpoint is due
+    // force copies the image even if no copy is due
+    void takeReadbacks(bool force = false);
+    // whether a copy is started
+    bool takeReadback(ImageReadback& readback, const std::vector<GLuint>& textures, int progress, int total,
+                      int every, int& lastProgress, bool force);
+    void pollReadbacks(bool wait);
+    // adaptive sampling only
+    // copy the converged count of the frame to read it later
+    void copyConvergedCount();
+    // whether a copy that is done counts every pixel, without waiting for the gpu
+    bool allPixelsConverged();
+    double samplesTaken() const;
 
     std::unique_ptr<GLSLProgram> m_prog;
     std::unique_ptr<GLSLProgram> m_renderTexProg;
     std::unique_ptr<FullScreenQuad> m_quad;
     std::unique_ptr<RenderInput> m_renderInput;
+    // replaces m_prog with the wavefront integrator
+    std::unique_ptr<WavefrontTracer> m_wavefront;
 
-    glm::vec2 m_windowOrigin;
-    glm::vec2 m_windowSize;
+    // the blocked render mode only
+    std::unique_ptr<TileScheduler> m_tiles;
+    int m_tilesLeft;
+    // the tiles rendered, the timings of the tiles index them
+    std::vector<Tile> m_renderedTiles;
+    std::unique_ptr<TileCosts> m_tileCosts;
+    std::vector<std::string> m_saveTileCosts;
+
+    // times every tile, or every frame of samples in the fullscreen render mode
+    std::unique_ptr<GpuTimer> m_gpuTimer;
+    int m_timedDispatches;
+    double m_dispatchMs;
+    double m_maxDispatchMs;
+    // the first sample of the most expensive frame
+    int m_maxDispatchSample;
 
     int m_width;
     int m_height;
@@ -78,14 +212,45 @@ private:
 
     GLuint m_fbo;
     GLuint m_colorTex;
+    // the luminance moments of the pixels and the count of the converged
+    // ones, 0 unless the sampling is adaptive
+    GLuint m_momentsTex;
+    GLuint m_convergedBuffer;
+    // a ring of copies of the converged count with a fence each
+    std::vector<GLuint> m_convergedCopies;
+    std::vector<GLsync> m_convergedFences;
+    int m_convergedHead;
+    int m_convergedCount;
+    bool m_allConverged;
 
     int m_curIter;
     int m_iterNum;
     int m_numSamples;
+    // null if the samples or the tiles per frame are fixed
+    std::unique_ptr<FrameBudget> m_frameBudget;
 
-    GLuint m_timeQuery;
+    // the timestamps of the start and the end of the render
+    GLuint m_timeQueries[2];
     bool m_queryEnded;
 
+    // null unless snapshots are taken
+    std::unique_ptr<ImageReadback> m_snapshotReadback;
+    int m_snapshotEvery;
+    // the progress of the last snapshot taken
+    int m_snapshotProgress;
+    snapshot_t m_onSnapshot;
+    // null unless checkpoints are written, copies the moments of adaptive
+    // sampling with the image
+    std::unique_ptr<ImageReadback> m_checkpointReadback;
+    int m_checkpointEvery;
+    int m_checkpointProgress;
+    // the samples per frame when each copy in flight was taken, oldest first
+    std::deque<int> m_checkpointIterNums;
+    checkpoint_t m_onCheckpoint;
+    std::uint64_t m_sceneHash;
+    // the samples of the checkpoint resumed from
+    double m_resumedRays;
+
     renderComplete_t m_onRenderComplete;
 };
 
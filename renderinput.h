@@ -10,6 +10,11 @@ class RenderInput
 public:
     virtual ~RenderInput() = default;
     virtual void setInput(GLSLProgram& prog) const = 0;
+
+    // the traversal stack size the shader needs for the uploaded nodes
+    int stackSize() const { return m_stackSize; }
+protected:
+    int m_stackSize = 1;
 };
 
 #endif // RENDER_INPUT_H
\ No newline at end of file
@@ -1,53 +1,21 @@
 #include "scene.h"
 #include "utils.h"
+#include "thread_pool.h"
 
 #include <glm/glm.hpp>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
 
-namespace 
+std::vector<SphereObject> createSpheres(int gridSize, const MaterialMix& mix)
 {
+    std::vector<SphereObject> objects;
+    objects.emplace_back( glm::vec3(0, -1000, 0), 1000.0f, Diffuse, glm::vec3(1) * 0.5f );
 
-int flatten(const bvh_node* root, SceneBuffer& buffer)
-{
-    if (!root) {
-        return -1;
-    }
-
-    int index = (int)buffer.nodes.size();
-    buffer.nodes.emplace_back();
-    Node curNode;
-    curNode.min = root->get_aabb().min;
-    curNode.max = root->get_aabb().max;
-    curNode.firstObjIndex = (int)buffer.objects.size();
-    curNode.numObj = root->num_objects();
-
-    for (int i = 0; i < root->num_objects(); ++i) {
-        auto obj = static_cast<const SphereObject*>(root->get_object(i));
-        auto& target = buffer.objects.emplace_back();
-        target.center = obj->center;
-        target.radius = obj->radius;
-
-        auto& mat = buffer.materials.emplace_back();
-        mat.albedo = obj->albedo;
-        mat.type = static_cast<float>(obj->type);
-        mat.prop = obj->prop;
-    }
-
-    curNode.left = flatten(root->left(), buffer);
-    curNode.right = flatten(root->right(), buffer);
-    buffer.nodes[index] = curNode;
-
-    return index;
-}
-
-} // anonymous namespace
-
-Scene createScene()
-{
-    Scene scene;
-    scene.objects.emplace_back( glm::vec3(0, -1000, 0), 1000.0f, Diffuse, glm::vec3(1) * 0.5f );
-
-    const int x_count = 11, y_count = 11;
+    const int x_count = gridSize, y_count = gridSize;
     for (int a = -x_count; a < x_count; ++a) {
         for (int b = -y_count; b < y_count; ++b) {
             float choose_mat = utils::random();
@@ -56,12 +24,12 @@ Scene createScene()
                 SphereObject obj;
                 obj.center = center;
                 obj.radius = 0.2f;
-                if (choose_mat < 0.8f) {
+                if (choose_mat < mix.diffuse) {
                     obj.albedo = glm::vec3(utils::random() * utils::random(),
                                            utils::random() * utils::random(),
                                            utils::random() * utils::random());
                     obj.type = Diffuse;
-                } else if (choose_mat < 0.95f) {
+                } else if (choose_mat < 1.0f - mix.dielectric) {
                     obj.albedo = glm::vec3(0.5f * (1 + utils::random()),
                                            0.5f * (1 + utils::random()),
                                            0.5f * (1 + utils::random()));
@@ -71,24 +39,277 @@ Scene createScene()
                     obj.type = Dielectric;
                     obj.prop = 1.5f;
                 }
-                scene.objects.push_back(obj);
+                objects.push_back(obj);
             }
         }
     }
 
-    scene.objects.emplace_back( glm::vec3(0, 1, 0), 1.0f, Dielectric, glm::vec3(0), 1.5f );
-    scene.objects.emplace_back( glm::vec3(-4, 1, 0), 1.0f, Diffuse, glm::vec3(0.4, 0.2, 0.1) );
-    scene.objects.emplace_back( glm::vec3(4, 1, 0), 1.0f, Metal, glm::vec3(0.7, 0.6, 0.5) );
+    objects.emplace_back( glm::vec3(0, 1, 0), 1.0f, Dielectric, glm::vec3(0), 1.5f );
+    objects.emplace_back( glm::vec3(-4, 1, 0), 1.0f, Diffuse, glm::vec3(0.4, 0.2, 0.1) );
+    objects.emplace_back( glm::vec3(4, 1, 0), 1.0f, Metal, glm::vec3(0.7, 0.6, 0.5) );
+    return objects;
+}
+
+Scene createScene(int gridSize, bvh_builder builder, int maxLeafSize, const MaterialMix& mix)
+{
+    Scene scene;
+    scene.objects = createSpheres(gridSize, mix);
 
     std::vector<object*> objects;
     for (auto& o : scene.objects) {
         objects.push_back(&o);
     }
-    scene.root = std::make_unique<bvh_node>(objects.data(), objects.size());
+    scene.bvh = std::make_unique<bvh_tree>(objects.data(), objects.size(), &thread_pool::instance(), builder, maxLeafSize);
     return scene;
 }
 
-SceneBuffer::SceneBuffer(const Scene& scene)
+namespace
+{
+
+// the number of stack entries the shader needs, it descends into the nearest
+// child and pushes the other children it has to visit. forEachChild(i, f)
+// calls f with the children of node i that are nodes, which are stored
+// after their parent
+template<typename F>
+int traversalStackSize(int numNodes, const F& forEachChild)
+{
+    std::vector<int> pending(numNodes, 0);
+    int size = 1;
+    for (int i = 0; i < numNodes; ++i) {
+        int num = 0;
+        forEachChild(i, [&](int) { ++num; });
+        int pushed = pending[i] + std::max(num - 1, 0);
+        size = std::max(size, pushed);
+        forEachChild(i, [&](int child) { pending[child] = pushed; });
+    }
+    return size;
+}
+
+template<int W>
+void copyWideNodes(const bvh_tree& tree, std::vector<char>& buffer, int& nodeSize, int& stackSize)
+{
+    wide_bvh_tree<W> wideTree(tree);
+    const auto& nodes = wideTree.nodes();
+    nodeSize = sizeof(nodes[0]);
+    buffer.resize(nodes.size() * nodeSize);
+    std::memcpy(buffer.data(), nodes.data(), buffer.size());
+
+    stackSize = traversalStackSize(nodes.size(), [&](int i, const auto& f) {
+        for (int k = 0; k < W; ++k) {
+            if (nodes[i].child[k] != -1 && nodes[i].count[k] == 0) {
+                f(nodes[i].child[k]);
+            }
+        }
+    });
+}
+
+constexpr int QuantizedMax = 255;
+constexpr int MaxLeafObjects = 3;
+
+// the grid of a node along one axis, the children are quantized to
+// origin + [0, QuantizedMax] * scale
+struct QuantizationGrid
+{
+    float origin;
+    float scale;
+    std::uint32_t frame;
+};
+
+QuantizationGrid makeGrid(float lo, float hi)
+{
+    // keep the top 24 bits of the origin, rounding away from hi so that the
+    // grid still covers the box
+    std::uint32_t bits;
+    std::memcpy(&bits, &lo, sizeof(bits));
+    if (bits & 0x80000000u) {
+        bits = (bits + 0xffu) & ~0xffu;
+    } else {
+        bits &= ~0xffu;
+    }
+    float origin;
+    std::memcpy(&origin, &bits, sizeof(origin));
+
+    // the smallest power of two cell size that covers the box
+    int exponent = -126;
+    if (hi > origin) {
+        std::frexp((hi - origin) / QuantizedMax, &exponent);
+        exponent = std::max(exponent, -126);
+    }
+    while (origin + QuantizedMax * std::ldexp(1.0f, exponent) < hi) {
+        ++exponent;
+    }
+    float scale = std::ldexp(1.0f, exponent);
+    return { origin, scale, bits | std::uint32_t(exponent + 127) };
+}
+
+// the grid cells enclosing [lo, hi], rounded outwards
+std::pair<std::uint32_t, std::uint32_t> quantize(const QuantizationGrid& grid, float lo, float hi)
+{
+    int qlo = std::clamp((int)std::floor((lo - grid.origin) / grid.scale), 0, QuantizedMax);
+    while (qlo > 0 && grid.origin + qlo * grid.scale > lo) {
+        --qlo;
+    }
+    int qhi = std::clamp((int)std::ceil((hi - grid.origin) / grid.scale), 0, QuantizedMax);
+    while (qhi < QuantizedMax && grid.origin + qhi * grid.scale < hi) {
+        ++qhi;
+    }
+    return { (std::uint32_t)qlo, (std::uint32_t)qhi };
+}
+
+int leafReference(int first, int count)
+{
+    if (count > MaxLeafObjects) {
+        throw std::runtime_error("too many objects in a leaf to compress");
+    }
+    return ~(first << 2 | count);
+}
+
+// children are indices into the tree nodes, -1 for an empty slot
+void compressNode(const std::vector<bvh_node>& nodes, const std::vector<int>& nodeIndices,
+                  const aabb3& volume, const int children[2], CompressedNode& dst)
 {
-    flatten(scene.root.get(), *this);
+    for (int axis = 0; axis < 3; ++axis) {
+        auto grid = makeGrid(volume.min[axis], volume.max[axis]);
+        dst.frame[axis] = grid.frame;
+        dst.bounds[axis] = 0;
+        for (int k = 0; k < 2; ++k) {
+            if (children[k] == -1) {
+                continue;
+            }
+            const auto& child = nodes[children[k]].volume;
+            auto q = quantize(grid, child.min[axis], child.max[axis]);
+            dst.bounds[axis] |= q.first << (k * 8) | q.second << (16 + k * 8);
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        if (children[k] == -1) {
+            dst.children[k] = leafReference(0, 0);
+        } else if (nodes[children[k]].is_leaf()) {
+            dst.children[k] = leafReference(nodes[children[k]].first, nodes[children[k]].count);
+        } else {
+            dst.children[k] = nodeIndices[children[k]];
+        }
+    }
+}
+
+void compressTree(const bvh_tree& tree, std::vector<CompressedNode>& compressed)
+{
+    const auto& nodes = tree.nodes();
+    if (nodes.empty()) {
+        return;
+    }
+
+    // only the inner nodes are stored, the leaves are packed into their parents
+    std::vector<int> nodeIndices(nodes.size(), -1);
+    int numInner = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_leaf()) {
+            nodeIndices[i] = numInner++;
+        }
+    }
+
+    if (numInner == 0) {
+        // a single leaf, give it a root with an empty sibling
+        const int children[2] = { 0, -1 };
+        compressed.resize(1);
+        compressNode(nodes, nodeIndices, nodes[0].volume, children, compressed[0]);
+        return;
+    }
+
+    compressed.resize(numInner);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_leaf()) {
+            const int children[2] = { nodes[i].left, nodes[i].right };
+            compressNode(nodes, nodeIndices, nodes[i].volume, children, compressed[nodeIndices[i]]);
+        }
+    }
+}
+
+void copyNode(const bvh_node& src, Node& dst)
+{
+    dst.min = src.volume.min;
+    dst.max = src.volume.max;
+    dst.left = src.left;
+    dst.right = src.right;
+    dst.firstObjIndex = src.first;
+    dst.numObj = src.count;
+}
+
+// emit the subtree in depth first order with the left child right after its
+// parent, and link each node to the node following its subtree
+void flattenSkipLinks(const std::vector<bvh_node>& treeNodes, int i, std::vector<Node>& nodes)
+{
+    const auto& src = treeNodes[i];
+    int index = nodes.size();
+    nodes.emplace_back();
+    copyNode(src, nodes[index]);
+    if (!src.is_leaf()) {
+        nodes[index].left = index + 1;
+        flattenSkipLinks(treeNodes, src.left, nodes);
+        flattenSkipLinks(treeNodes, src.right, nodes);
+    }
+    nodes[index].right = nodes.size();
+}
+
+} // anonymous namespace
+
+SceneBuffer::SceneBuffer(const Scene& scene, int bvhWidth, bool compressNodes, bool skipLinks)
+    : wideNodeSize(0)
+    , bvhWidth(bvhWidth)
+    , stackSize(1)
+{
+    if (compressNodes) {
+        compressTree(*scene.bvh, compressedNodes);
+        stackSize = traversalStackSize(compressedNodes.size(), [&](int i, const auto& f) {
+            for (int child : compressedNodes[i].children) {
+                if (child >= 0) {
+                    f(child);
+                }
+            }
+        });
+    } else if (bvhWidth == 4) {
+        copyWideNodes<4>(*scene.bvh, wideNodes, wideNodeSize, stackSize);
+    } else if (bvhWidth == 8) {
+        copyWideNodes<8>(*scene.bvh, wideNodes, wideNodeSize, stackSize);
+    } else if (skipLinks) {
+        const auto& treeNodes = scene.bvh->nodes();
+        nodes.reserve(treeNodes.size());
+        if (!treeNodes.empty()) {
+            flattenSkipLinks(treeNodes, 0, nodes);
+        }
+        // the traversal ends when it skips past the last node
+        for (auto& node : nodes) {
+            if (node.right == (int)nodes.size()) {
+                node.right = -1;
+            }
+        }
+        stackSize = 0;
+    } else {
+        // the tree is already flattened in depth first order
+        const auto& treeNodes = scene.bvh->nodes();
+        nodes.resize(treeNodes.size());
+        for (size_t i = 0; i < treeNodes.size(); ++i) {
+            copyNode(treeNodes[i], nodes[i]);
+        }
+        stackSize = traversalStackSize(nodes.size(), [&](int i, const auto& f) {
+            if (nodes[i].left != -1) {
+                f(nodes[i].left);
+                f(nodes[i].right);
+            }
+        });
+    }
+
+    // the objects are stored in the order the leaves reference them
+    const auto& indices = scene.bvh->indices();
+    objects.resize(indices.size());
+    materials.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const auto& obj = scene.objects[indices[i]];
+        objects[i].center = obj.center;
+        objects[i].radius = obj.radius;
+
+        materials[i].albedo = obj.albedo;
+        materials[i].type = static_cast<float>(obj.type);
+        materials[i].prop = obj.prop;
+    }
 }
\ No newline at end of file
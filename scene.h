@@ -5,12 +5,13 @@
 
 #include "bvh_node.h"
 #include "sphere_object.h"
+#include <cstdint>
 #include <vector>
 
 struct Scene
 {
     std::vector<SphereObject> objects;
-    std::unique_ptr<bvh_node> root;
+    std::unique_ptr<bvh_tree> bvh;
 };
 
 struct Node
@@ -18,12 +19,28 @@ struct Node
     glm::vec3 min; float _pad0;
     glm::vec3 max; float _pad1;
 
+    // with skip links, left is the next node in depth first order for inner
+    // nodes and right the node to continue with when the node is missed
     int left; // left node index
     int right; // right node index
     int firstObjIndex;
     int numObj;
 };
 
+// a binary node holding the bounds of its two children quantized to 8 bits
+// on a grid local to the node, the children are either other compressed
+// nodes or leaves packed into the child reference
+struct CompressedNode
+{
+    // per axis, the grid origin rounded down to 24 bits of precision with
+    // the biased exponent of the grid cell size in the low 8 bits
+    std::uint32_t frame[3];
+    // per axis, the left min, right min, left max and right max grid cells
+    std::uint32_t bounds[3];
+    // the compressed node index, or ~(first object << 2 | count) for leaves
+    int children[2];
+};
+
 struct Sphere
 {
     glm::vec3 center;
@@ -41,13 +58,43 @@ struct Material
 
 struct SceneBuffer
 {
-    SceneBuffer(const Scene& scene);
+    // bvhWidth > 2 collapses the tree into wide nodes, compressNodes
+    // quantizes the binary tree, skipLinks lays out the binary tree for a
+    // stackless traversal
+    SceneBuffer(const Scene& scene, int bvhWidth = 2, bool compressNodes = false, bool skipLinks = false);
 
+    // the binary nodes, empty if the tree is collapsed or compressed
     std::vector<Node> nodes;
+    // the inner nodes of the binary tree, compressNodes only
+    std::vector<CompressedNode> compressedNodes;
+    // the raw wide_bvh_node<bvhWidth> array, the layout matches std430
+    std::vector<char> wideNodes;
+    int wideNodeSize;
+    int bvhWidth;
+    // the traversal stack size the shader needs for the nodes, 0 with skip links
+    int stackSize;
+
     std::vector<Sphere> objects;
     std::vector<Material> materials;
 };
 
-Scene createScene();
+// the color of the sky straight up, it fades to white at the horizon
+const glm::vec3 SkyColor(0.5f, 0.7f, 1.0f);
+
+// the number of small spheres along each half axis of the default scene
+constexpr int DefaultGridSize = 11;
+
+// the fractions of the small spheres made of each material
+struct MaterialMix
+{
+    float diffuse = 0.8f;
+    float metal = 0.15f;
+    float dielectric = 0.05f;
+};
+
+// generate the random sphere field on a (2 * gridSize)^2 grid
+std::vector<SphereObject> createSpheres(int gridSize, const MaterialMix& mix = MaterialMix());
+Scene createScene(int gridSize = DefaultGridSize, bvh_builder builder = bvh_builder::sah,
+                  int maxLeafSize = bvh_tree::default_max_leaf_size, const MaterialMix& mix = MaterialMix());
 
 #endif // SCENE_H
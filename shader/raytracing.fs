@@ -41,6 +41,37 @@ struct Node {
     NodeData data;
 };
 
+#ifndef BVH_WIDTH
+#  define BVH_WIDTH 2
+#endif
+
+#if BVH_WIDTH > 2
+// the number of vec4 needed to store one property of all the children
+const int ChildGroups = BVH_WIDTH / 4;
+
+// must match wide_bvh_node
+struct WideNode {
+    // min x, y, z then max x, y, z of the children
+    vec4 bounds[6 * ChildGroups];
+    // the inner node index or the first object index of the children, -1 for empty slots
+    ivec4 children[ChildGroups];
+    // the number of objects of the leaf children, 0 for inner children
+    ivec4 counts[ChildGroups];
+};
+#endif
+
+#ifdef COMPRESSED_NODES
+// must match CompressedNode
+struct CompressedNode {
+    // xyz: the grid origin with the biased exponent of the grid cell size in the low 8 bits
+    // w: the quantized x bounds of the children
+    uvec4 frame;
+    // xy: the quantized y and z bounds of the children
+    // zw: the left and right node index, or ~(first object << 2 | count) for leaves
+    ivec4 data;
+};
+#endif
+
 struct Material {
     // xyz = albeo color
     // w = material type
@@ -53,7 +84,11 @@ struct Material {
 
 #ifdef TEXTURE_INPUT
 
+#  ifdef COMPRESSED_NODES
+uniform usampler1D NodeAABBTex;
+#  else
 uniform sampler1D NodeAABBTex;
+#  endif
 uniform isampler1D NodeDataTex;
 uniform sampler1D ObjectTex;
 uniform sampler1D MaterialTex;
@@ -70,6 +105,28 @@ Material getMaterial(int i)
         texelFetch(MaterialTex, i * 2 + 1, 0).x);
 }
 
+#  ifdef COMPRESSED_NODES
+CompressedNode getCompressedNode(int i)
+{
+    return CompressedNode(texelFetch(NodeAABBTex, i, 0), texelFetch(NodeDataTex, i, 0));
+}
+#  elif BVH_WIDTH > 2
+// component 0-2 for min x, y, z, 3-5 for max x, y, z
+vec4 getChildBounds(int i, int component, int group)
+{
+    return texelFetch(NodeAABBTex, (i * 6 + component) * ChildGroups + group, 0);
+}
+
+ivec4 getChildren(int i, int group)
+{
+    return texelFetch(NodeDataTex, i * 2 * ChildGroups + group, 0);
+}
+
+ivec4 getChildCounts(int i, int group)
+{
+    return texelFetch(NodeDataTex, (i * 2 + 1) * ChildGroups + group, 0);
+}
+#  else
 AABB getAABB(int i)
 {
     return AABB(texelFetch(NodeAABBTex, i * 2, 0),
@@ -81,6 +138,7 @@ NodeData getNodeData(int i)
     ivec4 data = texelFetch(NodeDataTex, i, 0);
     return NodeData(data.x, data.y, data.z, data.w);
 }
+#  endif
 
 #else
 #  if defined(UBO_INPUT)
@@ -99,7 +157,13 @@ layout(std140) uniform Scene {
 #elif defined(SSBO_INPUT)
 
 layout(std430, binding = 0) buffer NodeBuffer {
+#  if defined(COMPRESSED_NODES)
+    CompressedNode nodes[];
+#  elif BVH_WIDTH > 2
+    WideNode nodes[];
+#  else
     Node nodes[];
+#  endif
 };
 layout(std430, binding = 1) buffer ObjectBuffer {
     vec4 spheres[];
@@ -120,6 +184,27 @@ Material getMaterial(int i)
     return materials[i];
 }
 
+#  if defined(COMPRESSED_NODES)
+CompressedNode getCompressedNode(int i)
+{
+    return nodes[i];
+}
+#  elif BVH_WIDTH > 2
+vec4 getChildBounds(int i, int component, int group)
+{
+    return nodes[i].bounds[component * ChildGroups + group];
+}
+
+ivec4 getChildren(int i, int group)
+{
+    return nodes[i].children[group];
+}
+
+ivec4 getChildCounts(int i, int group)
+{
+    return nodes[i].counts[group];
+}
+#  else
 AABB getAABB(int i)
 {
     return nodes[i].aabb;
@@ -129,6 +214,7 @@ NodeData getNodeData(int i)
 {
     return nodes[i].data;
 }
+#  endif
 #endif
 
 #ifdef FRAGMENT_SHADER
@@ -150,11 +236,17 @@ vec2 fragCoord()
 #  define KERNEL_SIZE 16
 #endif
 
+#if defined(WAVEFRONT) && !defined(WAVEFRONT_GENERATE)
+// the wavefront kernels after the generation run over the ray queues
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+#else
 layout(local_size_x = KERNEL_SIZE, local_size_y = KERNEL_SIZE) in;
+#endif
 #ifdef BLOCK_REFINE
 layout(rgba8, binding = 0) uniform image2D OutImage;
 #else
-layout(rgba16, binding = 0) uniform image2D OutImage;
+// the sum of the samples of the pixel and their count in alpha
+layout(rgba32f, binding = 0) uniform image2D OutImage;
 #endif
 
 vec2 fragCoord()
@@ -167,6 +259,54 @@ void writeColor(vec4 color)
     imageStore(OutImage, ivec2(fragCoord()), color);
 }
 
+#  ifdef ADAPTIVE_SAMPLING
+// a pixel is converged once the standard error of its mean luminance falls
+// below NoiseThreshold times the mean, or it has taken NumSamples samples.
+// Converged pixels are skipped by the later dispatches
+uniform float NoiseThreshold;
+// the samples a pixel takes before its variance is trusted
+uniform int MinSamples;
+
+// per pixel the sum of the luminance, the sum of its square, the number of
+// samples and 1 once the pixel is converged
+layout(rgba32f, binding = 1) uniform image2D MomentsImage;
+
+layout(std430, binding = 8) buffer ConvergedBuffer {
+    uint convergedPixels;
+};
+
+float luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool pixelConverged(ivec2 coord)
+{
+    return imageLoad(MomentsImage, coord).w != 0;
+}
+
+// add the sum of count samples to the pixel
+void addSamples(ivec2 coord, vec3 colorSum, float lumSum, float lumSquareSum, int count)
+{
+    vec4 moments = imageLoad(MomentsImage, coord);
+    moments.xyz += vec3(lumSum, lumSquareSum, count);
+    float n = moments.z;
+    imageStore(OutImage, coord, imageLoad(OutImage, coord) + vec4(colorSum, count));
+
+    bool converged = n >= NumSamples;
+    if (!converged && n >= MinSamples) {
+        float lumMean = moments.x / n;
+        float variance = max(moments.y / n - lumMean * lumMean, 0.0) * n / (n - 1);
+        converged = sqrt(variance / n) <= NoiseThreshold * max(lumMean, 1e-3);
+    }
+    if (converged) {
+        moments.w = 1;
+        atomicAdd(convergedPixels, 1u);
+    }
+    imageStore(MomentsImage, coord, moments);
+}
+#  endif
+
 #endif // !FRAGMENT_SHADER
 
 vec3 g_CameraLookDir;
@@ -214,7 +354,7 @@ float intersectSphere(vec4 sphere, Ray ray, float tmin, float tmax)
     float c = dot(oc, oc) - sphere.w * sphere.w;
     float discriminant = b*b - a*c;
     if (discriminant < 0) {
-        return -1;
+        return -1.0;
     }
     float sqrtDisr = sqrt(discriminant);
     float t = (-b - sqrtDisr) / a;
@@ -225,7 +365,7 @@ float intersectSphere(vec4 sphere, Ray ray, float tmin, float tmax)
     if (tmin <= t && t <= tmax) {
         return t;
     }
-    return -1;
+    return -1.0;
 }
 
 vec3 getRayDir(vec2 jitter)
@@ -250,75 +390,304 @@ struct HitRecord {
     Material material;
 };
 
-bool intersect(Ray r, AABB volume, float tmin, float tmax)
+#ifndef STACK_SIZE
+#  define STACK_SIZE 32
+#endif
+
+// the number of nodes fetched by the traversals of the invocation
+int g_visitedNodes = 0;
+
+// test the ray against the spheres [first, first + count), tmax shrinks to the closest hit
+// an any hit test returns at the first hit
+void intersectLeaf(Ray ray, int first, int count, float tmin, inout float tmax, bool anyHit, inout int sphereIndex)
 {
-    for (int i = 0; i < 3; ++i) {
-        float t0 = (volume.min[i] - r.origin[i]) / r.dir[i];
-        float t1 = (volume.max[i] - r.origin[i]) / r.dir[i];
-        if (r.dir[i] < 0) {
-            float tmp = t0;
-            t0 = t1;
-            t1 = tmp;
+    for (int i = first; i < first + count; ++i) {
+        float t = intersectSphere(getSphere(i), ray, tmin, tmax);
+        if (t != -1) {
+            tmax = t;
+            sphereIndex = i;
+            if (anyHit) {
+                return;
+            }
         }
-        tmin = max(tmin, t0);
-        tmax = min(tmax, t1);
     }
-    return tmin < tmax;
 }
 
-const int MaxIndices = 64;
+// the traversals descend into the nearest child and push the other children
+// the ray hits together with the distance it enters them, so that the nodes
+// behind the closest hit found in the meantime are skipped when popped.
+// STACK_SIZE is computed from the tree so that the bound checks on the
+// pushes never fail, they only keep the writes in bounds.
+// traverse() looks for the closest hit, or for any hit if anyHit is set, in
+// which case it returns at the first sphere hit
+
+#if defined(COMPRESSED_NODES)
+// decode the bounds of both children along the axis as
+// (left min, right min, left max, right max)
+vec4 decodeChildBounds(CompressedNode node, int axis)
+{
+    uint frame = node.frame[axis];
+    uint bounds = axis == 0 ? node.frame.w : uint(node.data[axis - 1]);
+    float origin = uintBitsToFloat(frame & 0xffffff00u);
+    float scale = uintBitsToFloat((frame & 0xffu) << 23);
+    uvec4 cells = (uvec4(bounds) >> uvec4(0, 8, 16, 24)) & 0xffu;
+    return origin + vec4(cells) * scale;
+}
 
-int[MaxIndices] findPossibleHits(Ray ray, float tmin, float tmax, out int num)
+bvec2 intersectChildren(Ray ray, vec3 invDir, CompressedNode node, float tmin, float tmax, out vec2 tnear)
 {
-    num = 0;
-    int hits[MaxIndices];
-    int stack[32];
-    stack[0] = 0;
-    int i = 1;
+    tnear = vec2(tmin);
+    vec2 tfar = vec2(tmax);
+    for (int i = 0; i < 3; ++i) {
+        vec4 bounds = decodeChildBounds(node, i);
+        vec2 t0 = (bounds.xy - ray.origin[i]) * invDir[i];
+        vec2 t1 = (bounds.zw - ray.origin[i]) * invDir[i];
+        tnear = max(tnear, min(t0, t1));
+        tfar = min(tfar, max(t0, t1));
+    }
+    return lessThan(tnear, tfar);
+}
 
-    while (i > 0) {
-        --i;
-        if (intersect(ray, getAABB(stack[i]), tmin, tmax)) {
-            // leaf node
-            NodeData node = getNodeData(stack[i]);
-            if (node.left == -1) {
-                for (int j = 0; j < node.numObjects; ++j) {
-                    hits[num++] = node.firstObjIndex + j;
+int traverse(Ray ray, float tmin, inout float tmax, bool anyHit)
+{
+    int sphereIndex = -1;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+    vec3 invDir = 1.0 / ray.dir;
+
+    int node = 0;
+    while (node != -1) {
+        ++g_visitedNodes;
+        CompressedNode current = getCompressedNode(node);
+        vec2 tnear;
+        bvec2 hitChildren = intersectChildren(ray, invDir, current, tmin, tmax, tnear);
+        int nearest = tnear.y < tnear.x ? 1 : 0;
+        node = -1;
+        for (int j = 0; j < 2; ++j) {
+            int k = nearest ^ j;
+            // a leaf in front may have moved tmax before the child
+            if (!hitChildren[k] || tnear[k] >= tmax) {
+                continue;
+            }
+            int child = current.data[2 + k];
+            if (child < 0) {
+                intersectLeaf(ray, ~child >> 2, ~child & 3, tmin, tmax, anyHit, sphereIndex);
+                if (anyHit && sphereIndex != -1) {
+                    return sphereIndex;
                 }
-            } else {
-                stack[i++] = node.right;
-                stack[i++] = node.left;
+            } else if (node == -1) {
+                node = child;
+            } else if (sp < STACK_SIZE) {
+                stack[sp] = child;
+                stackT[sp++] = tnear[k];
+            }
+        }
+        while (node == -1 && sp > 0) {
+            --sp;
+            if (stackT[sp] < tmax) {
+                node = stack[sp];
             }
         }
     }
-    return hits;
+    return sphereIndex;
+}
+#elif BVH_WIDTH > 2
+// test the ray against 4 children of the node at once
+bvec4 intersectChildren(Ray ray, vec3 invDir, int node, int group, float tmin, float tmax, out vec4 tnear)
+{
+    tnear = vec4(tmin);
+    vec4 tfar = vec4(tmax);
+    for (int i = 0; i < 3; ++i) {
+        vec4 t0 = (getChildBounds(node, i, group) - ray.origin[i]) * invDir[i];
+        vec4 t1 = (getChildBounds(node, i + 3, group) - ray.origin[i]) * invDir[i];
+        tnear = max(tnear, min(t0, t1));
+        tfar = min(tfar, max(t0, t1));
+    }
+    return lessThan(tnear, tfar);
 }
 
-bool hit(Ray ray, float tmin, float tmax, out HitRecord rec)
+int traverse(Ray ray, float tmin, inout float tmax, bool anyHit)
 {
     int sphereIndex = -1;
-    float minT = Infinity;
-#ifdef BRUTE_FORCE_HIT_TEST
-    for (int i = 0; i < NumSpheres; ++i) {
-        float t = intersectSphere(getSphere(i), ray, tmin, tmax);
-        if (t != -1 && minT > t) {
-            minT = t;
-            sphereIndex = i;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+    vec3 invDir = 1.0 / ray.dir;
+
+    int node = 0;
+    while (node != -1) {
+        ++g_visitedNodes;
+        int current = node;
+        float nodeT = Infinity;
+        int base = sp;
+        node = -1;
+        for (int g = 0; g < ChildGroups; ++g) {
+            vec4 tnear;
+            bvec4 hitChildren = intersectChildren(ray, invDir, current, g, tmin, tmax, tnear);
+            if (!any(hitChildren)) {
+                continue;
+            }
+            ivec4 children = getChildren(current, g);
+            ivec4 counts = getChildCounts(current, g);
+            for (int k = 0; k < 4; ++k) {
+                if (!hitChildren[k] || children[k] == -1 || tnear[k] >= tmax) {
+                    continue;
+                }
+                if (counts[k] > 0) {
+                    intersectLeaf(ray, children[k], counts[k], tmin, tmax, anyHit, sphereIndex);
+                    if (anyHit && sphereIndex != -1) {
+                        return sphereIndex;
+                    }
+                    continue;
+                }
+                // keep the nearest child to descend into, the pushed ones
+                // are sorted so that the nearer ones are popped first
+                int child = children[k];
+                float t = tnear[k];
+                if (t < nodeT) {
+                    int tmp = node;
+                    node = child;
+                    child = tmp;
+                    float tmpT = nodeT;
+                    nodeT = t;
+                    t = tmpT;
+                }
+                if (child != -1 && sp < STACK_SIZE) {
+                    int p = sp++;
+                    for (; p > base && stackT[p - 1] < t; --p) {
+                        stack[p] = stack[p - 1];
+                        stackT[p] = stackT[p - 1];
+                    }
+                    stack[p] = child;
+                    stackT[p] = t;
+                }
+            }
+        }
+        // a leaf may have hit in front of the nearest child
+        if (nodeT >= tmax) {
+            node = -1;
+        }
+        while (node == -1 && sp > 0) {
+            --sp;
+            if (stackT[sp] < tmax) {
+                node = stack[sp];
+            }
         }
     }
+    return sphereIndex;
+}
 #else
-    int num;
-    int hits[MaxIndices] = findPossibleHits(ray, tmin, tmax, num);
-    for (int i = 0; i < num; ++i) {
-        float t = intersectSphere(getSphere(hits[i]), ray, tmin, tmax);
-        if (t != -1 && minT > t) {
-            minT = t;
-            sphereIndex = hits[i];
+bool intersect(Ray ray, vec3 invDir, AABB volume, float tmin, float tmax, out float tnear)
+{
+    vec3 t0 = (volume.min.xyz - ray.origin) * invDir;
+    vec3 t1 = (volume.max.xyz - ray.origin) * invDir;
+    vec3 tsmall = min(t0, t1);
+    vec3 tbig = max(t0, t1);
+    tnear = max(tmin, max(tsmall.x, max(tsmall.y, tsmall.z)));
+    float tfar = min(tmax, min(tbig.x, min(tbig.y, tbig.z)));
+    return tnear < tfar;
+}
+
+#  ifdef SKIP_LINKS
+// the nodes are in depth first order, the traversal moves on to the next node
+// when it hits an inner node and follows the skip link in node.right when it
+// misses a node or is done with a leaf. It needs no stack but visits the
+// children in a fixed order
+int traverse(Ray ray, float tmin, inout float tmax, bool anyHit)
+{
+    int sphereIndex = -1;
+    vec3 invDir = 1.0 / ray.dir;
+
+    // the links only point forward and the traversal ends with -1, checking
+    // for that keeps the loop finite even for a lane that reads a zeroed node
+    int node = 0;
+    int last = -1;
+    while (node > last) {
+        last = node;
+        ++g_visitedNodes;
+        NodeData current = getNodeData(node);
+        float tnear;
+        if (!intersect(ray, invDir, getAABB(node), tmin, tmax, tnear)) {
+            node = current.right;
+        } else if (current.left == -1) {
+            intersectLeaf(ray, current.firstObjIndex, current.numObjects, tmin, tmax, anyHit, sphereIndex);
+            if (anyHit && sphereIndex != -1) {
+                return sphereIndex;
+            }
+            node = current.right;
+        } else {
+            node = current.left;
+        }
+    }
+    return sphereIndex;
+}
+#  else // SKIP_LINKS
+int traverse(Ray ray, float tmin, inout float tmax, bool anyHit)
+{
+    int sphereIndex = -1;
+    int stack[STACK_SIZE];
+    float stackT[STACK_SIZE];
+    int sp = 0;
+    vec3 invDir = 1.0 / ray.dir;
+
+    float tnear;
+    int node = intersect(ray, invDir, getAABB(0), tmin, tmax, tnear) ? 0 : -1;
+    while (node != -1) {
+        ++g_visitedNodes;
+        NodeData current = getNodeData(node);
+        node = -1;
+        if (current.left == -1) {
+            intersectLeaf(ray, current.firstObjIndex, current.numObjects, tmin, tmax, anyHit, sphereIndex);
+            if (anyHit && sphereIndex != -1) {
+                return sphereIndex;
+            }
+        } else {
+            float tl, tr;
+            bool hitLeft = intersect(ray, invDir, getAABB(current.left), tmin, tmax, tl);
+            bool hitRight = intersect(ray, invDir, getAABB(current.right), tmin, tmax, tr);
+            if (hitLeft && hitRight) {
+                if (tl <= tr) {
+                    node = current.left;
+                    if (sp < STACK_SIZE) {
+                        stack[sp] = current.right;
+                        stackT[sp++] = tr;
+                    }
+                } else {
+                    node = current.right;
+                    if (sp < STACK_SIZE) {
+                        stack[sp] = current.left;
+                        stackT[sp++] = tl;
+                    }
+                }
+            } else if (hitLeft) {
+                node = current.left;
+            } else if (hitRight) {
+                node = current.right;
+            }
+        }
+        while (node == -1 && sp > 0) {
+            --sp;
+            if (stackT[sp] < tmax) {
+                node = stack[sp];
+            }
         }
     }
+    return sphereIndex;
+}
+#  endif // !SKIP_LINKS
+#endif
+
+bool hit(Ray ray, float tmin, float tmax, out HitRecord rec)
+{
+    int sphereIndex = -1;
+#ifdef BRUTE_FORCE_HIT_TEST
+    intersectLeaf(ray, 0, NumSpheres, tmin, tmax, false, sphereIndex);
+#else
+    sphereIndex = traverse(ray, tmin, tmax, false);
 #endif
     if (sphereIndex != -1) {
-        rec.pt = ray.origin + minT * ray.dir;
+        rec.pt = ray.origin + tmax * ray.dir;
         rec.normal = normalize(rec.pt - getSphere(sphereIndex).xyz);
         rec.material = getMaterial(sphereIndex);
         return true;
@@ -326,6 +695,19 @@ bool hit(Ray ray, float tmin, float tmax, out HitRecord rec)
     return false;
 }
 
+// whether anything blocks the ray within [tmin, tmax], for the shadow and
+// visibility rays that need no hit record
+bool occluded(Ray ray, float tmin, float tmax)
+{
+    int sphereIndex = -1;
+#ifdef BRUTE_FORCE_HIT_TEST
+    intersectLeaf(ray, 0, NumSpheres, tmin, tmax, true, sphereIndex);
+#else
+    sphereIndex = traverse(ray, tmin, tmax, true);
+#endif
+    return sphereIndex != -1;
+}
+
 bool diffuseScatter(vec3 rayDir, HitRecord rec, out vec3 attenuation, out vec3 scattered)
 {
     scattered = normalize(rec.normal + randomInUnitSphere()); 
@@ -387,15 +769,38 @@ bool dielectricScatter(vec3 rayDir, HitRecord rec, out vec3 attenuation, out vec
 vec3 raytrace(vec2 jitter)
 {
     Ray ray = Ray(CameraPos, getRayDir(jitter));
-    int num;
-    int hits[MaxIndices] = findPossibleHits(ray, 0, Infinity, num);
-    return vec3(float(num) / 32);
+    HitRecord rec;
+    hit(ray, 0, Infinity, rec);
+    return vec3(float(g_visitedNodes) / 32);
 }
-#else // DEBUG_BVH_HITS
+#elif defined(AMBIENT_OCCLUSION)
+
+// the occlusion rays ignore the spheres further than this
+#ifndef AO_DISTANCE
+#  define AO_DISTANCE 2.0
+#endif
+
+// light the primary hit by the sky in one cosine weighted direction,
+// unless a sphere nearer than AO_DISTANCE blocks it
 vec3 raytrace(vec2 jitter)
 {
-    const int MaxIter = 50;
+    HitRecord rec;
+    Ray ray = Ray(CameraPos, getRayDir(jitter));
+    if (!hit(ray, 0.0001, Infinity, rec)) {
+        return getBackgroundColor(ray.dir);
+    }
+    vec3 dir = normalize(rec.normal + randomInUnitSphere());
+    if (occluded(Ray(rec.pt, dir), 0.0001, AO_DISTANCE)) {
+        return vec3(0);
+    }
+    return rec.material.albedo.rgb * getBackgroundColor(dir);
+}
+#else // !AMBIENT_OCCLUSION
+// the longest path, the number of bounces the wavefront renderer dispatches
+const int MaxIter = 50;
 
+vec3 raytrace(vec2 jitter)
+{
     vec3 color = vec3(1);
     HitRecord rec;
     Ray ray = Ray(CameraPos, getRayDir(jitter));
@@ -434,9 +839,9 @@ vec3 raytrace(vec2 jitter)
     color *= getBackgroundColor(ray.dir);
     return color;
 }
-#endif // !DEBUG_BVH_HITS
+#endif // !DEBUG_BVH_HITS && !AMBIENT_OCCLUSION
 
-void main()
+void initCamera()
 {
     g_CameraLookDir = normalize(CameraLookAt - CameraPos);
     g_CameraRight = cross(g_CameraLookDir, vec3(0, 1, 0));
@@ -444,6 +849,226 @@ void main()
 
     g_halfImageSize.y = tan(FovY / 2) * FocalLength;
     g_halfImageSize.x = g_halfImageSize.y * ScreenSize.x / ScreenSize.y;
+}
+
+#ifdef WAVEFRONT
+// the path tracer split into kernels that run one after the other over the
+// paths of one sample per pixel: generate the camera rays, extend the paths
+// to their closest hits, shade the hits and compact the paths still alive.
+// The kernels pass the paths through queues of path indices that are filled
+// with atomic counters and consumed with indirect dispatches. The
+// optional sort kernel bins the hits by material between the extension and
+// the shading, every bin is then shaded by a dispatch of its own.
+
+struct PathState {
+    vec3 origin;
+    int pixel;
+    vec3 dir;
+    int seed;
+    vec3 throughput;
+    // the bounces so far, -1 once the path is terminated
+    int depth;
+};
+
+struct PathHit {
+    float t;
+    int sphere;
+};
+
+layout(std430, binding = 3) buffer PathBuffer {
+    PathState paths[];
+};
+
+layout(std430, binding = 4) buffer HitBuffer {
+    PathHit hits[];
+};
+
+// the queue the kernel consumes, it starts with the indirect dispatch
+// command that covers it
+layout(std430, binding = 5) buffer InQueue {
+    uint inNumGroups[3];
+    uint inCount;
+    uint inPaths[];
+};
+
+// the queue the kernel fills, the dispatch command grows with it
+layout(std430, binding = 6) buffer OutQueue {
+    uint outNumGroups[3];
+    uint outCount;
+    uint outPaths[];
+};
+
+void appendPath(uint path)
+{
+    uint i = atomicAdd(outCount, 1u);
+    outPaths[i] = path;
+    if (i % WAVEFRONT_GROUP_SIZE == 0) {
+        atomicMax(outNumGroups[0], i / WAVEFRONT_GROUP_SIZE + 1);
+    }
+}
+
+#  ifdef WAVEFRONT_SORT
+// the queue of each material and one of the missed paths last, every queue
+// starts MaterialQueueStride uints after the previous one and has the
+// layout of InQueue
+uniform int MaterialQueueStride;
+
+layout(std430, binding = 7) buffer MaterialQueues {
+    uint materialQueues[];
+};
+
+const int MissQueue = 3;
+
+void appendMaterialPath(int queue, uint path)
+{
+    int header = queue * MaterialQueueStride;
+    uint i = atomicAdd(materialQueues[header + 3], 1u);
+    materialQueues[header + 4 + int(i)] = path;
+    if (i % WAVEFRONT_GROUP_SIZE == 0) {
+        atomicMax(materialQueues[header], i / WAVEFRONT_GROUP_SIZE + 1);
+    }
+}
+#  endif
+
+// add the color of a terminated path to its pixel
+void accumulate(int pixel, vec3 color)
+{
+    ivec2 coord = ivec2(pixel % int(ScreenSize.x), pixel / int(ScreenSize.x));
+#  ifdef ADAPTIVE_SAMPLING
+    float lum = luminance(color);
+    addSamples(coord, color, lum, lum * lum, 1);
+#  else
+    imageStore(OutImage, coord, imageLoad(OutImage, coord) + vec4(color, 1));
+#  endif
+}
+
+#  if defined(WAVEFRONT_GENERATE)
+void main()
+{
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+    if (coord.x >= int(ScreenSize.x) || coord.y >= int(ScreenSize.y)) {
+        return;
+    }
+#    ifdef ADAPTIVE_SAMPLING
+    if (pixelConverged(coord)) {
+        return;
+    }
+#    endif
+    initCamera();
+
+    // IterNum is 1, the random sequence of the megakernel tracing one
+    // sample per frame. The megakernel batches of more samples continue
+    // the sequence of their first sample instead
+    g_seed = IterStart * 17 + IterNum;
+    vec3 dir = getRayDir(randomInUnitRect());
+    int pixel = coord.y * int(ScreenSize.x) + coord.x;
+    paths[pixel] = PathState(CameraPos, pixel, dir, g_seed, vec3(1), 0);
+    appendPath(uint(pixel));
+}
+#  elif defined(WAVEFRONT_EXTEND)
+void main()
+{
+    if (gl_GlobalInvocationID.x >= inCount) {
+        return;
+    }
+    uint path = inPaths[gl_GlobalInvocationID.x];
+    Ray ray = Ray(paths[path].origin, paths[path].dir);
+    float tmax = Infinity;
+    int sphereIndex = -1;
+#    ifdef BRUTE_FORCE_HIT_TEST
+    intersectLeaf(ray, 0, NumSpheres, 0.0001, tmax, false, sphereIndex);
+#    else
+    sphereIndex = traverse(ray, 0.0001, tmax, false);
+#    endif
+    hits[path] = PathHit(tmax, sphereIndex);
+}
+#  elif defined(WAVEFRONT_SHADE)
+void main()
+{
+    if (gl_GlobalInvocationID.x >= inCount) {
+        return;
+    }
+    uint index = inPaths[gl_GlobalInvocationID.x];
+    PathState path = paths[index];
+    PathHit pathHit = hits[index];
+
+    if (pathHit.sphere == -1) {
+        accumulate(path.pixel, path.throughput * getBackgroundColor(path.dir));
+        paths[index].depth = -1;
+        return;
+    }
+
+    HitRecord rec;
+    rec.pt = path.origin + pathHit.t * path.dir;
+    rec.normal = normalize(rec.pt - getSphere(pathHit.sphere).xyz);
+    rec.material = getMaterial(pathHit.sphere);
+
+    g_seed = path.seed;
+    vec3 scatteredDir;
+    vec3 attenuation;
+    bool scattered = false;
+    switch (int(rec.material.albedo.w)) {
+    case TypeDiffuse:
+        scattered = diffuseScatter(path.dir, rec, attenuation, scatteredDir);
+        break;
+
+    case TypeMetal:
+        scattered = metalScatter(path.dir, rec, attenuation, scatteredDir);
+        break;
+
+    case TypeDielectric:
+        scattered = dielectricScatter(path.dir, rec, attenuation, scatteredDir);
+        break;
+    }
+
+    if (!scattered) {
+        accumulate(path.pixel, vec3(0));
+        path.depth = -1;
+    } else {
+        path.origin = rec.pt;
+        path.dir = scatteredDir;
+        path.seed = g_seed;
+        path.throughput *= attenuation;
+        ++path.depth;
+        if (path.depth == MaxIter) {
+            accumulate(path.pixel, path.throughput * getBackgroundColor(path.dir));
+            path.depth = -1;
+        }
+    }
+    paths[index] = path;
+}
+#  elif defined(WAVEFRONT_SORT)
+void main()
+{
+    if (gl_GlobalInvocationID.x >= inCount) {
+        return;
+    }
+    uint path = inPaths[gl_GlobalInvocationID.x];
+    int sphere = hits[path].sphere;
+    appendMaterialPath(sphere == -1 ? MissQueue : int(getMaterial(sphere).albedo.w), path);
+}
+#  elif defined(WAVEFRONT_COMPACT)
+void main()
+{
+    if (gl_GlobalInvocationID.x >= inCount) {
+        return;
+    }
+    uint path = inPaths[gl_GlobalInvocationID.x];
+    if (paths[path].depth != -1) {
+        appendPath(path);
+    }
+}
+#  endif
+#else // !WAVEFRONT
+void main()
+{
+#if defined(BLOCK_REFINE) && defined(COMPUTE_SHADER)
+    // the work groups of a tile reach past its edges
+    if (any(greaterThanEqual(fragCoord(), Window.zw))) {
+        return;
+    }
+#endif
+    initCamera();
 
     vec3 color = vec3(0);
 
@@ -454,18 +1079,37 @@ void main()
     }
 
     writeColor(vec4(color / NumSamples, 1));
-#else // !BLOCK_REFINE
+#elif defined(ADAPTIVE_SAMPLING)
+    ivec2 coord = ivec2(fragCoord());
+    if (coord.x >= int(ScreenSize.x) || coord.y >= int(ScreenSize.y) || pixelConverged(coord)) {
+        return;
+    }
+    g_seed = IterStart * 17 + IterNum;
+    int iterEnd = min(NumSamples, IterStart + IterNum);
+    float lumSum = 0;
+    float lumSquareSum = 0;
+    for (int i = IterStart; i < iterEnd; ++i) {
+        vec3 sampleColor = raytrace(randomInUnitRect());
+        float lum = luminance(sampleColor);
+        color += sampleColor;
+        lumSum += lum;
+        lumSquareSum += lum * lum;
+    }
+    addSamples(coord, color, lumSum, lumSquareSum, iterEnd - IterStart);
+#else // !ADAPTIVE_SAMPLING
     g_seed = IterStart * 17 + IterNum;;
     int iterEnd = min(NumSamples, IterStart + IterNum);
     for (int i = IterStart; i < iterEnd; ++i) {
         color += raytrace(randomInUnitRect());
     }
 
-    color /= NumSamples;
+    // the raw sum and the count, resolve.fs divides them for display
+    vec4 sum = vec4(color, iterEnd - IterStart);
 #  ifdef COMPUTE_SHADER
-    // blend with the existing color
-    color += imageLoad(OutImage, ivec2(fragCoord())).xyz;
+    // the fragment shader is blended with the existing sum
+    sum += imageLoad(OutImage, ivec2(fragCoord()));
 #  endif
-    writeColor(vec4(color, 1));
-#endif // !BLOCK_REFINE
-}
\ No newline at end of file
+    writeColor(sum);
+#endif // !ADAPTIVE_SAMPLING
+}
+#endif // !WAVEFRONT
\ No newline at end of file
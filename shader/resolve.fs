@@ -0,0 +1,13 @@
+#version 410
+
+// the sums of the samples accumulated by raytracing.fs with their count in alpha
+
+uniform sampler2D MainTex;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec4 sum = texelFetch(MainTex, ivec2(gl_FragCoord.xy), 0);
+    FragColor = vec4(sum.rgb / max(sum.a, 1.0), 1);
+}
\ No newline at end of file
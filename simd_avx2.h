@@ -0,0 +1,55 @@
+#ifndef SIMD_AVX2_H
+#define SIMD_AVX2_H
+
+#pragma once
+
+// the AVX2 float vector of the traversal kernels, only for the translation
+// units built for the instruction set. The types have internal linkage so
+// that they do not clash with the ones of the other instruction sets
+
+#include <immintrin.h>
+
+namespace
+{
+
+struct vmask
+{
+    __m256 m;
+};
+
+struct vfloat
+{
+    using mask = vmask;
+    static constexpr int size = 8;
+
+    static vfloat load(const float* p) { return { _mm256_load_ps(p) }; }
+    static vfloat loadu(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static vfloat set1(float f) { return { _mm256_set1_ps(f) }; }
+    static void store(float* p, vfloat a) { _mm256_store_ps(p, a.v); }
+
+    __m256 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a, vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline vfloat operator*(vfloat a, vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline vfloat operator/(vfloat a, vfloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)) }; }
+inline vfloat vmin(vfloat a, vfloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline vfloat vmax(vfloat a, vfloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline vfloat vsqrt(vfloat a) { return { _mm256_sqrt_ps(a.v) }; }
+
+inline vmask operator<(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline vmask operator<=(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline vmask operator>=(vfloat a, vfloat b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline vmask operator&(vmask a, vmask b) { return { _mm256_and_ps(a.m, b.m) }; }
+inline vmask operator|(vmask a, vmask b) { return { _mm256_or_ps(a.m, b.m) }; }
+inline int movemask(vmask a) { return _mm256_movemask_ps(a.m); }
+inline bool any(vmask a) { return !_mm256_testz_ps(a.m, a.m); }
+
+// a where the mask is set, b elsewhere
+inline vfloat blend(vmask m, vfloat a, vfloat b) { return { _mm256_blendv_ps(b.v, a.v, m.m) }; }
+
+} // anonymous namespace
+
+#endif // SIMD_AVX2_H
\ No newline at end of file
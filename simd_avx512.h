@@ -0,0 +1,59 @@
+#ifndef SIMD_AVX512_H
+#define SIMD_AVX512_H
+
+#pragma once
+
+// the AVX-512F float vector of the traversal kernels, only for the translation
+// units built for the instruction set. The types have internal linkage so
+// that they do not clash with the ones of the other instruction sets
+
+#include <immintrin.h>
+
+namespace
+{
+
+struct vmask
+{
+    __mmask16 m;
+};
+
+struct vfloat
+{
+    using mask = vmask;
+    static constexpr int size = 16;
+
+    static vfloat load(const float* p) { return { _mm512_load_ps(p) }; }
+    static vfloat loadu(const float* p) { return { _mm512_loadu_ps(p) }; }
+    static vfloat set1(float f) { return { _mm512_set1_ps(f) }; }
+    static void store(float* p, vfloat a) { _mm512_store_ps(p, a.v); }
+
+    __m512 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return { _mm512_add_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a, vfloat b) { return { _mm512_sub_ps(a.v, b.v) }; }
+inline vfloat operator*(vfloat a, vfloat b) { return { _mm512_mul_ps(a.v, b.v) }; }
+inline vfloat operator/(vfloat a, vfloat b) { return { _mm512_div_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a)
+{
+    // the float xor needs AVX-512DQ, flip the sign bit on the integers
+    return { _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x80000000))) };
+}
+inline vfloat vmin(vfloat a, vfloat b) { return { _mm512_min_ps(a.v, b.v) }; }
+inline vfloat vmax(vfloat a, vfloat b) { return { _mm512_max_ps(a.v, b.v) }; }
+inline vfloat vsqrt(vfloat a) { return { _mm512_sqrt_ps(a.v) }; }
+
+inline vmask operator<(vfloat a, vfloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+inline vmask operator<=(vfloat a, vfloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+inline vmask operator>=(vfloat a, vfloat b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+inline vmask operator&(vmask a, vmask b) { return { (__mmask16)(a.m & b.m) }; }
+inline vmask operator|(vmask a, vmask b) { return { (__mmask16)(a.m | b.m) }; }
+inline int movemask(vmask a) { return a.m; }
+inline bool any(vmask a) { return a.m != 0; }
+
+// a where the mask is set, b elsewhere
+inline vfloat blend(vmask m, vfloat a, vfloat b) { return { _mm512_mask_blend_ps(m.m, b.v, a.v) }; }
+
+} // anonymous namespace
+
+#endif // SIMD_AVX512_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef SIMD_SSE_H
+#define SIMD_SSE_H
+
+#pragma once
+
+// the SSE2 float vector of the traversal kernels, only for the translation
+// units built for the instruction set. The types have internal linkage so
+// that they do not clash with the ones of the other instruction sets
+
+#include <emmintrin.h>
+
+namespace
+{
+
+struct vmask
+{
+    __m128 m;
+};
+
+struct vfloat
+{
+    using mask = vmask;
+    static constexpr int size = 4;
+
+    static vfloat load(const float* p) { return { _mm_load_ps(p) }; }
+    static vfloat loadu(const float* p) { return { _mm_loadu_ps(p) }; }
+    static vfloat set1(float f) { return { _mm_set1_ps(f) }; }
+    static void store(float* p, vfloat a) { _mm_store_ps(p, a.v); }
+
+    __m128 v;
+};
+
+inline vfloat operator+(vfloat a, vfloat b) { return { _mm_add_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a, vfloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline vfloat operator*(vfloat a, vfloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline vfloat operator/(vfloat a, vfloat b) { return { _mm_div_ps(a.v, b.v) }; }
+inline vfloat operator-(vfloat a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)) }; }
+inline vfloat vmin(vfloat a, vfloat b) { return { _mm_min_ps(a.v, b.v) }; }
+inline vfloat vmax(vfloat a, vfloat b) { return { _mm_max_ps(a.v, b.v) }; }
+inline vfloat vsqrt(vfloat a) { return { _mm_sqrt_ps(a.v) }; }
+
+inline vmask operator<(vfloat a, vfloat b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline vmask operator<=(vfloat a, vfloat b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline vmask operator>=(vfloat a, vfloat b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+inline vmask operator&(vmask a, vmask b) { return { _mm_and_ps(a.m, b.m) }; }
+inline vmask operator|(vmask a, vmask b) { return { _mm_or_ps(a.m, b.m) }; }
+inline int movemask(vmask a) { return _mm_movemask_ps(a.m); }
+inline bool any(vmask a) { return movemask(a) != 0; }
+
+// a where the mask is set, b elsewhere
+inline vfloat blend(vmask m, vfloat a, vfloat b)
+{
+    return { _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)) };
+}
+
+} // anonymous namespace
+
+#endif // SIMD_SSE_H
\ No newline at end of file
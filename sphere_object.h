@@ -2,7 +2,9 @@
 #define SPHERE_H
 
 #include "object.h"
+#include "ray.h"
 #include <glm/glm.hpp>
+#include <cmath>
 
 enum MaterialType {
     Diffuse,
@@ -10,6 +12,8 @@ enum MaterialType {
     Dielectric
 };
 
+constexpr int MaterialTypeCount = 3;
+
 class SphereObject : public object
 {
 public:
@@ -29,6 +33,29 @@ public:
         return { center, radius };
     }
 
+    // the first intersection within [tmin, tmax], -1 if there is none
+    float hit(const ray& r, float tmin, float tmax) const
+    {
+        glm::vec3 oc = r.origin - center;
+        float a = glm::dot(r.dir, r.dir);
+        float b = glm::dot(oc, r.dir);
+        float c = glm::dot(oc, oc) - radius * radius;
+        float discriminant = b * b - a * c;
+        if (discriminant < 0) {
+            return -1;
+        }
+        float sqrtDisr = std::sqrt(discriminant);
+        float t = (-b - sqrtDisr) / a;
+        if (tmin <= t && t <= tmax) {
+            return t;
+        }
+        t = (-b + sqrtDisr) / a;
+        if (tmin <= t && t <= tmax) {
+            return t;
+        }
+        return -1;
+    }
+
     glm::vec3 center;
     float radius;
 
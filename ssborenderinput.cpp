@@ -11,9 +11,19 @@ namespace
     }
 }
 
-SsboRenderInput::SsboRenderInput(const Scene& scene)
+SsboRenderInput::SsboRenderInput(const Scene& scene, int bvhWidth, bool compressNodes, bool skipLinks)
 {
-    SceneBuffer buffer(scene);
+    SceneBuffer buffer(scene, bvhWidth, compressNodes, skipLinks);
+    m_stackSize = buffer.stackSize;
+    const void* nodeData = buffer.nodes.data();
+    m_nodeBufferSize = sizeof(Node) * buffer.nodes.size();
+    if (!buffer.wideNodes.empty()) {
+        nodeData = buffer.wideNodes.data();
+        m_nodeBufferSize = buffer.wideNodes.size();
+    } else if (!buffer.compressedNodes.empty()) {
+        nodeData = buffer.compressedNodes.data();
+        m_nodeBufferSize = sizeof(CompressedNode) * buffer.compressedNodes.size();
+    }
 
     glGenBuffers(1, &m_ssbo);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
@@ -21,7 +31,6 @@ SsboRenderInput::SsboRenderInput(const Scene& scene)
     GLint align;
     glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
 
-    m_nodeBufferSize = sizeof(Node) * buffer.nodes.size();
     m_nodeBufferAlignedSize = roundUp(m_nodeBufferSize, align);
 
     m_objectBufferSize = sizeof(Sphere) * buffer.objects.size();
@@ -33,7 +42,7 @@ SsboRenderInput::SsboRenderInput(const Scene& scene)
                  GL_STATIC_DRAW);
 
     auto p = static_cast<char*>(glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY));
-    std::memcpy(p, buffer.nodes.data(), m_nodeBufferSize);
+    std::memcpy(p, nodeData, m_nodeBufferSize);
     p += m_nodeBufferAlignedSize;
     std::memcpy(p, buffer.objects.data(), m_objectBufferSize);
     p += m_objectBufferAlignedSize;
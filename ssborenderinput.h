@@ -12,7 +12,7 @@ class GLSLProgram;
 class SsboRenderInput : public RenderInput
 {
 public:
-    SsboRenderInput(const Scene& scene);
+    SsboRenderInput(const Scene& scene, int bvhWidth, bool compressNodes, bool skipLinks);
     ~SsboRenderInput();
 
     void setInput(GLSLProgram& prog) const override;
@@ -7,51 +7,103 @@
 
 #include <iterator>
 #include <cassert>
+#include <cstring>
 #include <vector>
 #include <stdexcept>
 
-TextureRenderInput::TextureRenderInput(const Scene& scene)
+namespace
 {
-    SceneBuffer buffer(scene);
+
+// integer textures are incomplete with the default mipmap filter, which
+// makes texelFetch return zero
+void setNearestFilter()
+{
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+} // anonymous namespace
+
+TextureRenderInput::TextureRenderInput(const Scene& scene, int bvhWidth, bool compressNodes, bool skipLinks)
+{
+    SceneBuffer buffer(scene, bvhWidth, compressNodes, skipLinks);
+    m_stackSize = buffer.stackSize;
+
+    std::vector<glm::vec4> aabbData;
+    std::vector<glm::ivec4> nodeData;
+    GLenum aabbFormat = GL_RGBA32F;
+    GLenum aabbType = GL_FLOAT;
+    if (!buffer.compressedNodes.empty()) {
+        // the first half of a compressed node goes to the unsigned aabb
+        // texture, the second half to the data texture
+        aabbFormat = GL_RGBA32UI;
+        aabbType = GL_UNSIGNED_INT;
+        aabbData.resize(buffer.compressedNodes.size());
+        nodeData.resize(buffer.compressedNodes.size());
+        for (auto i = 0u; i < buffer.compressedNodes.size(); ++i) {
+            const auto& node = buffer.compressedNodes[i];
+            std::memcpy(&aabbData[i], &node, sizeof(glm::vec4));
+            std::memcpy(&nodeData[i], reinterpret_cast<const char*>(&node) + sizeof(glm::vec4),
+                        sizeof(glm::ivec4));
+        }
+    } else if (buffer.wideNodes.empty()) {
+        aabbData.resize(buffer.nodes.size() * 2);
+        nodeData.resize(buffer.nodes.size());
+        for (auto i = 0u; i < buffer.nodes.size(); ++i) {
+            const auto& node = buffer.nodes[i];
+            aabbData[i * 2] = { node.min, 0 };
+            aabbData[i * 2 + 1] = { node.max, 0 };
+            nodeData[i] = { node.left, node.right, node.firstObjIndex, node.numObj };
+        }
+    } else {
+        // a wide node is 6 * W / 4 texels of child bounds followed by
+        // W / 4 texels of child indices and W / 4 texels of object counts
+        int groups = bvhWidth / 4;
+        int numNodes = buffer.wideNodes.size() / buffer.wideNodeSize;
+        aabbData.resize(numNodes * groups * 6);
+        nodeData.resize(numNodes * groups * 2);
+        for (int i = 0; i < numNodes; ++i) {
+            const char* node = buffer.wideNodes.data() + i * buffer.wideNodeSize;
+            std::memcpy(&aabbData[i * groups * 6], node, groups * 6 * sizeof(glm::vec4));
+            std::memcpy(&nodeData[i * groups * 2], node + groups * 6 * sizeof(glm::vec4),
+                        groups * 2 * sizeof(glm::ivec4));
+        }
+    }
 
     GLint maxSize;
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
-    if ((int)buffer.nodes.size() * 2 > maxSize) {
+    if ((int)aabbData.size() > maxSize) {
         throw std::runtime_error("too many nodes");
     }
     if ((int)buffer.materials.size() * 2 > maxSize) {
         throw std::runtime_error("too many objects");
     }
 
-    std::vector<glm::vec4> aabbData(buffer.nodes.size() * 2);
-    std::vector<glm::ivec4> nodeData(buffer.nodes.size());
-    for (auto i = 0u; i < buffer.nodes.size(); ++i) {
-        const auto& node = buffer.nodes[i];
-        aabbData[i * 2] = { node.min, 0 };
-        aabbData[i * 2 + 1] = { node.max, 0 };
-        nodeData[i] = { node.left, node.right, node.firstObjIndex, node.numObj };
-    }
-
     glGenTextures(1, &m_nodeAABBTex);
     glBindTexture(GL_TEXTURE_1D, m_nodeAABBTex);
+    setNearestFilter();
     // aabb min, max, vec4
-    glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA32F, aabbData.size());
-    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, aabbData.size(), GL_RGBA, GL_FLOAT, aabbData.data());
+    glTexStorage1D(GL_TEXTURE_1D, 1, aabbFormat, aabbData.size());
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, aabbData.size(),
+                    aabbType == GL_FLOAT ? GL_RGBA : GL_RGBA_INTEGER, aabbType, aabbData.data());
     
     glGenTextures(1, &m_nodeDataTex);
     glBindTexture(GL_TEXTURE_1D, m_nodeDataTex);
+    setNearestFilter();
     // left, right, first, num
     glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA32I, nodeData.size());
     glTexSubImage1D(GL_TEXTURE_1D, 0, 0, nodeData.size(), GL_RGBA_INTEGER, GL_INT, nodeData.data());
 
     glGenTextures(1, &m_objectTex);
     glBindTexture(GL_TEXTURE_1D, m_objectTex);
+    setNearestFilter();
     // center and radius
     glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA32F, buffer.objects.size());
     glTexSubImage1D(GL_TEXTURE_1D, 0, 0, buffer.objects.size(), GL_RGBA, GL_FLOAT, buffer.objects.data());
 
     glGenTextures(1, &m_materialTex);
     glBindTexture(GL_TEXTURE_1D, m_materialTex);
+    setNearestFilter();
     glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA32F, buffer.materials.size() * 2);
     glTexSubImage1D(GL_TEXTURE_1D, 0, 0, buffer.materials.size() * 2, GL_RGBA, GL_FLOAT, buffer.materials.data());
 }
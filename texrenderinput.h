@@ -11,7 +11,7 @@ struct Scene;
 class TextureRenderInput : public RenderInput
 {
 public:
-    TextureRenderInput(const Scene& scene);
+    TextureRenderInput(const Scene& scene, int bvhWidth, bool compressNodes, bool skipLinks);
     ~TextureRenderInput();
 
     void setInput(GLSLProgram& prog) const override;
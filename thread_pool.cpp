@@ -0,0 +1,159 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// the pool and the queue index of the current worker thread
+thread_local const thread_pool* t_pool = nullptr;
+thread_local int t_queue = 0;
+
+} // anonymous namespace
+
+thread_pool::thread_pool(int num_threads)
+    : m_pending(0)
+    , m_stop(false)
+{
+    if (num_threads <= 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // queue 0 is shared by the threads outside the pool
+    for (int i = 0; i < num_threads; ++i) {
+        m_queues.push_back(std::make_unique<task_queue>());
+    }
+    for (int i = 1; i < num_threads; ++i) {
+        m_threads.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wakeup.notify_all();
+    for (auto& t : m_threads) {
+        t.join();
+    }
+}
+
+thread_pool& thread_pool::instance()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+void thread_pool::submit(task t)
+{
+    auto& queue = *m_queues[current_queue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(t));
+    }
+    ++m_pending;
+    if (!m_threads.empty()) {
+        // synchronize with the sleeping workers
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_wakeup.notify_one();
+}
+
+bool thread_pool::run_one()
+{
+    task t;
+    int index = current_queue();
+    if (pop(index, t) || steal(index, t)) {
+        t();
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::worker_loop(int index)
+{
+    t_pool = this;
+    t_queue = index;
+
+    for (;;) {
+        if (run_one()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wakeup.wait(lock, [this] { return m_stop || m_pending > 0; });
+        if (m_stop) {
+            return;
+        }
+    }
+}
+
+int thread_pool::current_queue() const
+{
+    return t_pool == this ? t_queue : 0;
+}
+
+bool thread_pool::pop(int index, task& t)
+{
+    auto& queue = *m_queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    t = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    --m_pending;
+    return true;
+}
+
+bool thread_pool::steal(int index, task& t)
+{
+    int n = (int)m_queues.size();
+    for (int i = 1; i < n; ++i) {
+        auto& queue = *m_queues[(index + i) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            t = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            --m_pending;
+            return true;
+        }
+    }
+    return false;
+}
+
+task_group::task_group(thread_pool* pool)
+    : m_pool(pool)
+    , m_count(0)
+{
+}
+
+task_group::~task_group()
+{
+    wait();
+}
+
+void task_group::run(std::function<void()> f)
+{
+    if (!m_pool) {
+        f();
+        return;
+    }
+
+    ++m_count;
+    m_pool->submit([this, f = std::move(f)] {
+        f();
+        --m_count;
+    });
+}
+
+void task_group::wait()
+{
+    while (m_count > 0) {
+        if (!m_pool->run_one()) {
+            std::this_thread::yield();
+        }
+    }
+}
\ No newline at end of file
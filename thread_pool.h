@@ -0,0 +1,92 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a work stealing thread pool
+// every worker owns a deque, pops its own tasks from the back and steals
+// from the front of the others. Threads outside the pool share one extra
+// deque and execute tasks while they wait for a task_group.
+class thread_pool
+{
+public:
+    using task = std::function<void()>;
+
+    // num_threads counts the calling thread, 0 means one per hardware thread
+    explicit thread_pool(int num_threads = 0);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    int num_threads() const { return (int)m_queues.size(); }
+
+    void submit(task t);
+    // run one pending task on the calling thread, return false if there is none
+    bool run_one();
+
+    // the pool shared by the whole application
+    static thread_pool& instance();
+private:
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    void worker_loop(int index);
+    int current_queue() const;
+    bool pop(int index, task& t);
+    bool steal(int index, task& t);
+
+    std::vector<std::unique_ptr<task_queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::atomic<int> m_pending;
+    bool m_stop;
+};
+
+// a set of tasks that can be waited for together
+// without a pool, the tasks are run immediately on the calling thread
+class task_group
+{
+public:
+    explicit task_group(thread_pool* pool);
+    ~task_group();
+
+    task_group(const task_group&) = delete;
+    task_group& operator=(const task_group&) = delete;
+
+    void run(std::function<void()> f);
+    // help executing the pending tasks until all the tasks of the group are done
+    void wait();
+private:
+    thread_pool* m_pool;
+    std::atomic<int> m_count;
+};
+
+// call f(begin, end) on the chunks of [first, last)
+// the chunks only depend on the grain size, not the number of threads
+template<typename F>
+void parallel_for(thread_pool* pool, int first, int last, int grain, F&& f)
+{
+    task_group group(pool);
+    for (int begin = first; begin < last; begin += grain) {
+        int end = begin + grain < last ? begin + grain : last;
+        group.run([&f, begin, end] { f(begin, end); });
+    }
+    group.wait();
+}
+
+#endif // THREAD_POOL_H
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "tilecosts.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// blue for the cheapest pixels through green to red for the most expensive
+void heatColor(float t, unsigned char rgb[3])
+{
+    t = std::clamp(t, 0.0f, 1.0f);
+    float r = std::clamp(2 * t - 1, 0.0f, 1.0f);
+    float g = 1 - std::abs(2 * t - 1);
+    float b = std::clamp(1 - 2 * t, 0.0f, 1.0f);
+    rgb[0] = (unsigned char)(r * 255 + 0.5f);
+    rgb[1] = (unsigned char)(g * 255 + 0.5f);
+    rgb[2] = (unsigned char)(b * 255 + 0.5f);
+}
+
+} // anonymous namespace
+
+TileCosts::TileCosts(int width, int height)
+    : m_width(width)
+    , m_height(height)
+{
+}
+
+TileCosts::TileCosts(const std::string& path)
+    : m_width(0)
+    , m_height(0)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream ss(line);
+        Entry e;
+        if (!(ss >> e.tile.x0 >> e.tile.y0 >> e.tile.x1 >> e.tile.y1 >> e.ms) || e.tile.area() <= 0) {
+            throw std::runtime_error("invalid tile costs in " + path);
+        }
+        m_width = std::max(m_width, e.tile.x1);
+        m_height = std::max(m_height, e.tile.y1);
+        m_entries.push_back(e);
+    }
+}
+
+void TileCosts::add(const Tile& tile, double ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.push_back({ tile, ms });
+}
+
+double TileCosts::cost(const Tile& tile) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double ms = 0;
+    for (const auto& e : m_entries) {
+        int w = std::min(tile.x1, e.tile.x1) - std::max(tile.x0, e.tile.x0);
+        int h = std::min(tile.y1, e.tile.y1) - std::max(tile.y0, e.tile.y0);
+        if (w > 0 && h > 0) {
+            ms += e.ms * w * h / e.tile.area();
+        }
+    }
+    return ms;
+}
+
+double TileCosts::totalMs() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double ms = 0;
+    for (const auto& e : m_entries) {
+        ms += e.ms;
+    }
+    return ms;
+}
+
+void TileCosts::save(const std::string& path) const
+{
+    if (endsWith(path, ".ppm")) {
+        saveHeatmap(path);
+        return;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    out << "x0,y0,x1,y1,ms\n";
+    for (const auto& e : m_entries) {
+        out << e.tile.x0 << "," << e.tile.y0 << "," << e.tile.x1 << "," << e.tile.y1 << "," << e.ms << "\n";
+    }
+}
+
+void TileCosts::saveHeatmap(const std::string& path) const
+{
+    // the cost of a pixel is the cost of its tile over the tile area
+    std::vector<float> costs(m_width * m_height, 0.0f);
+    float maxCost = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& e : m_entries) {
+            float cost = float(e.ms / e.tile.area());
+            for (int y = std::max(e.tile.y0, 0); y < std::min(e.tile.y1, m_height); ++y) {
+                for (int x = std::max(e.tile.x0, 0); x < std::min(e.tile.x1, m_width); ++x) {
+                    costs[y * m_width + x] += cost;
+                    maxCost = std::max(maxCost, costs[y * m_width + x]);
+                }
+            }
+        }
+    }
+
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    std::fprintf(f, "P6\n%d %d\n255\n", m_width, m_height);
+    std::vector<unsigned char> row(m_width * 3);
+    for (int y = m_height - 1; y >= 0; --y) {
+        for (int x = 0; x < m_width; ++x) {
+            heatColor(maxCost > 0 ? costs[y * m_width + x] / maxCost : 0, &row[x * 3]);
+        }
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+    std::fclose(f);
+}
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef TILE_COSTS_H
+#define TILE_COSTS_H
+
+#pragma once
+
+#include "tilescheduler.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// the measured render times of the tiles of an image. The costs are saved
+// as csv or as a heatmap, and a saved map estimates the cost of the tiles
+// of another tile size for the tile scheduler
+class TileCosts
+{
+public:
+    TileCosts(int width, int height);
+    // read a csv written by save
+    explicit TileCosts(const std::string& path);
+
+    // thread safe
+    void add(const Tile& tile, double ms);
+    // the cost of the area of the tile, the share of every measured tile it overlaps
+    double cost(const Tile& tile) const;
+    double totalMs() const;
+
+    // a .ppm path writes a heatmap of the cost per pixel, anything else csv
+    void save(const std::string& path) const;
+private:
+    struct Entry
+    {
+        Tile tile;
+        double ms;
+    };
+
+    void saveHeatmap(const std::string& path) const;
+
+    int m_width;
+    int m_height;
+    std::vector<Entry> m_entries;
+    mutable std::mutex m_mutex;
+};
+
+#endif // TILE_COSTS_H
\ No newline at end of file
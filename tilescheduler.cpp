@@ -0,0 +1,169 @@
+#include "tilescheduler.h"
+#include "tilecosts.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace
+{
+
+// the position of the d-th cell on the hilbert curve filling a n x n grid, n a power of 2
+void hilbertCell(int n, std::int64_t d, int& x, int& y)
+{
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & int(d / 2);
+        int ry = 1 & int(d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+// the tile coordinates in the order they are rendered
+std::vector<std::pair<int, int>> orderTiles(int tilesX, int tilesY, TileOrder order)
+{
+    std::vector<std::pair<int, int>> tiles;
+    tiles.reserve(tilesX * tilesY);
+    auto inside = [&](int x, int y) { return x >= 0 && y >= 0 && x < tilesX && y < tilesY; };
+    int cx = (tilesX - 1) / 2;
+    int cy = (tilesY - 1) / 2;
+
+    switch (order) {
+    case TileOrder::Raster:
+        for (int y = 0; y < tilesY; ++y) {
+            for (int x = 0; x < tilesX; ++x) {
+                tiles.emplace_back(x, y);
+            }
+        }
+        break;
+
+    case TileOrder::Cost:
+    case TileOrder::Spiral: {
+        // legs of 1, 1, 2, 2, 3, 3... tiles turning the same way
+        const int dx[] = { 1, 0, -1, 0 };
+        const int dy[] = { 0, 1, 0, -1 };
+        int x = cx;
+        int y = cy;
+        tiles.emplace_back(x, y);
+        for (int leg = 0; (int)tiles.size() < tilesX * tilesY; ++leg) {
+            for (int i = 0; i < leg / 2 + 1; ++i) {
+                x += dx[leg % 4];
+                y += dy[leg % 4];
+                if (inside(x, y)) {
+                    tiles.emplace_back(x, y);
+                }
+            }
+        }
+        break;
+    }
+
+    case TileOrder::Hilbert: {
+        int n = 1;
+        while (n < tilesX || n < tilesY) {
+            n *= 2;
+        }
+        std::int64_t cells = std::int64_t(n) * n;
+        std::int64_t center = 0;
+        for (std::int64_t d = 0; d < cells; ++d) {
+            int x, y;
+            hilbertCell(n, d, x, y);
+            if (x == cx && y == cy) {
+                center = d;
+                break;
+            }
+        }
+        // alternate between the two directions of the curve
+        for (std::int64_t i = 0; (int)tiles.size() < tilesX * tilesY; ++i) {
+            std::int64_t d = i % 2 ? center + (i + 1) / 2 : center - i / 2;
+            if (d < 0 || d >= cells) {
+                continue;
+            }
+            int x, y;
+            hilbertCell(n, d, x, y);
+            if (inside(x, y)) {
+                tiles.emplace_back(x, y);
+            }
+        }
+        break;
+    }
+    }
+    return tiles;
+}
+
+} // anonymous namespace
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, TileOrder order, int numWorkers,
+                             const TileCosts* costs)
+    : m_tileSize(tileSize)
+    , m_numStolen(0)
+{
+    if (order == TileOrder::Cost && !costs) {
+        throw std::runtime_error("the cost tile order needs the tile costs");
+    }
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    m_numTiles = tilesX * tilesY;
+
+    std::vector<Tile> tiles;
+    for (const auto& t : orderTiles(tilesX, tilesY, order)) {
+        Tile tile;
+        tile.x0 = t.first * tileSize;
+        tile.y0 = t.second * tileSize;
+        tile.x1 = std::min(tile.x0 + tileSize, width);
+        tile.y1 = std::min(tile.y0 + tileSize, height);
+        tiles.push_back(tile);
+    }
+    if (order == TileOrder::Cost) {
+        // the spiral order breaks the ties
+        std::vector<std::pair<double, Tile>> sorted;
+        for (const auto& tile : tiles) {
+            sorted.emplace_back(costs->cost(tile), tile);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            tiles[i] = sorted[i].second;
+        }
+    }
+
+    for (int i = 0; i < std::max(numWorkers, 1); ++i) {
+        m_queues.push_back(std::make_unique<TileQueue>());
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        m_queues[i % m_queues.size()]->tiles.push_back(tiles[i]);
+    }
+}
+
+bool TileScheduler::next(int worker, Tile& tile)
+{
+    {
+        auto& queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tiles.empty()) {
+            tile = queue.tiles.front();
+            queue.tiles.pop_front();
+            return true;
+        }
+    }
+
+    int n = (int)m_queues.size();
+    for (int i = 1; i < n; ++i) {
+        auto& queue = *m_queues[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tiles.empty()) {
+            tile = queue.tiles.back();
+            queue.tiles.pop_back();
+            ++m_numStolen;
+            return true;
+        }
+    }
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class TileOrder {
+    Raster,
+    // a square spiral out of the center tile
+    Spiral,
+    // along a hilbert curve over the tiles, both ways from the center tile
+    Hilbert,
+    // the most expensive tiles of a cost map first, so that the workers
+    // finish together
+    Cost
+};
+
+class TileCosts;
+
+struct Tile
+{
+    // the pixels [x0, x1) x [y0, y1), the edge tiles are cut to the image
+    int x0, y0;
+    int x1, y1;
+
+    int area() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// hands out the tiles of the image in priority order, the center of the
+// image first. The tiles are dealt round robin to the queues of the
+// workers, a worker takes the most important tile of its own queue and
+// steals the least important one of another queue once its own is empty
+class TileScheduler
+{
+public:
+    // the cost order needs the costs
+    TileScheduler(int width, int height, int tileSize, TileOrder order, int numWorkers = 1,
+                  const TileCosts* costs = nullptr);
+
+    TileScheduler(TileScheduler&) = delete;
+
+    int numTiles() const { return m_numTiles; }
+    int tileSize() const { return m_tileSize; }
+    // the tiles taken from another worker so far
+    int numStolen() const { return m_numStolen; }
+
+    // take the next tile of the worker, return false once all are taken
+    bool next(int worker, Tile& tile);
+private:
+    struct TileQueue
+    {
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+    };
+
+    int m_tileSize;
+    int m_numTiles;
+    std::vector<std::unique_ptr<TileQueue>> m_queues;
+    std::atomic<int> m_numStolen;
+};
+
+#endif // TILE_SCHEDULER_H
\ No newline at end of file
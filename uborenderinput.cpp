@@ -7,6 +7,7 @@
 
 #include <glm/glm.hpp>
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 namespace
@@ -20,6 +21,7 @@ constexpr int MaxObjects = 512;
 UboRenderInput::UboRenderInput(const Scene& scene)
 {
     SceneBuffer buffer(scene);
+    m_stackSize = buffer.stackSize;
 
     if (buffer.nodes.size() > MaxNodes) {
         throw std::runtime_error("too many nodes");
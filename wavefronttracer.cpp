@@ -0,0 +1,173 @@
+#include "wavefronttracer.h"
+#include "glutils.h"
+#include "sphere_object.h"
+
+#include <cstdint>
+
+namespace
+{
+
+// the work group size of the kernels run over the queues
+constexpr int GroupSize = 64;
+// the same as the work group size of the megakernel
+constexpr int KernelSize = 16;
+// MaxIter in raytracing.fs, every path is terminated after as many bounces
+constexpr int MaxBounces = 50;
+
+// the buffer bindings of raytracing.fs, after the ones of the scene
+constexpr GLuint PathBinding = 3;
+constexpr GLuint HitBinding = 4;
+constexpr GLuint InQueueBinding = 5;
+constexpr GLuint OutQueueBinding = 6;
+constexpr GLuint MaterialQueuesBinding = 7;
+
+// a queue per material and the one of the missed paths, MissQueue in raytracing.fs
+constexpr int NumMaterialQueues = MaterialTypeCount + 1;
+
+// the indirect dispatch command of a queue followed by the number of paths in it
+constexpr int QueueHeaderSize = 4 * sizeof(std::uint32_t);
+// PathState and PathHit in raytracing.fs
+constexpr int PathSize = 48;
+constexpr int HitSize = 8;
+
+} // anonymous namespace
+
+WavefrontTracer::WavefrontTracer(int width, int height, bool sortMaterials, const createProgram_t& createProgram)
+    : m_width(width)
+    , m_height(height)
+    , m_materialQueues(0)
+    , m_materialQueueStride(0)
+{
+    auto groupSize = "WAVEFRONT_GROUP_SIZE " + std::to_string(GroupSize);
+    m_generateProg = createProgram({ "WAVEFRONT", "WAVEFRONT_GENERATE", groupSize });
+    m_extendProg = createProgram({ "WAVEFRONT", "WAVEFRONT_EXTEND", groupSize });
+    m_shadeProg = createProgram({ "WAVEFRONT", "WAVEFRONT_SHADE", groupSize });
+    m_compactProg = createProgram({ "WAVEFRONT", "WAVEFRONT_COMPACT", groupSize });
+
+    // one path per pixel
+    int numPaths = width * height;
+    glGenBuffers(1, &m_pathBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pathBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, PathSize * numPaths, nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &m_hitBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_hitBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, HitSize * numPaths, nullptr, GL_DYNAMIC_COPY);
+
+    glGenBuffers(2, m_queues);
+    for (auto queue : m_queues) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, QueueHeaderSize + sizeof(std::uint32_t) * numPaths, nullptr,
+                     GL_DYNAMIC_COPY);
+    }
+
+    if (sortMaterials) {
+        // the queues are bound as ranges of one buffer, their offsets have to be aligned
+        GLint alignment;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        GLintptr size = QueueHeaderSize + sizeof(std::uint32_t) * numPaths;
+        m_materialQueueStride = (size + alignment - 1) / alignment * alignment;
+        glGenBuffers(1, &m_materialQueues);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_materialQueues);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_materialQueueStride * NumMaterialQueues, nullptr, GL_DYNAMIC_COPY);
+
+        m_sortProg = createProgram({ "WAVEFRONT", "WAVEFRONT_SORT", groupSize });
+        m_sortProg->use();
+        m_sortProg->setUniform("MaterialQueueStride", int(m_materialQueueStride / sizeof(std::uint32_t)));
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    GL_CHECK_ERROR;
+}
+
+WavefrontTracer::~WavefrontTracer()
+{
+    glDeleteBuffers(1, &m_pathBuffer);
+    glDeleteBuffers(1, &m_hitBuffer);
+    glDeleteBuffers(2, m_queues);
+    if (m_materialQueues) {
+        glDeleteBuffers(1, &m_materialQueues);
+    }
+}
+
+void WavefrontTracer::resetQueue(GLuint queue, GLintptr offset)
+{
+    // no groups to dispatch and no paths
+    const std::uint32_t header[] = { 0, 1, 1, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, sizeof(header), header);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// shade the paths of the queue, it is bound as the in queue and the
+// indirect dispatch buffer
+void WavefrontTracer::shade(GLuint queue)
+{
+    if (!m_sortProg) {
+        m_shadeProg->use();
+        glDispatchComputeIndirect(0);
+        return;
+    }
+
+    for (int i = 0; i < NumMaterialQueues; ++i) {
+        resetQueue(m_materialQueues, i * m_materialQueueStride);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MaterialQueuesBinding, m_materialQueues);
+    m_sortProg->use();
+    glDispatchComputeIndirect(0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+    // the shading reads each material queue as its in queue
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_materialQueues);
+    m_shadeProg->use();
+    for (int i = 0; i < NumMaterialQueues; ++i) {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, InQueueBinding, m_materialQueues, i * m_materialQueueStride,
+                          m_materialQueueStride);
+        glDispatchComputeIndirect(i * m_materialQueueStride);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InQueueBinding, queue);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queue);
+}
+
+void WavefrontTracer::render(int sample)
+{
+    // the shading of the previous sample updates the image, the moments and
+    // the paths that this one reads
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PathBinding, m_pathBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HitBinding, m_hitBuffer);
+
+    int in = 0;
+    resetQueue(m_queues[in]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OutQueueBinding, m_queues[in]);
+    m_generateProg->use();
+    m_generateProg->setUniform("IterStart", sample);
+    // a sample at a time, however many samples the frame traces
+    m_generateProg->setUniform("IterNum", 1);
+    glDispatchCompute((m_width + KernelSize - 1) / KernelSize, (m_height + KernelSize - 1) / KernelSize, 1);
+
+    // the paths are terminated by the shading of the last bounce at the latest
+    for (int i = 0; i < MaxBounces; ++i) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InQueueBinding, m_queues[in]);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_queues[in]);
+
+        m_extendProg->use();
+        glDispatchComputeIndirect(0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        shade(m_queues[in]);
+        if (i + 1 == MaxBounces) {
+            break;
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        int out = 1 - in;
+        resetQueue(m_queues[out]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OutQueueBinding, m_queues[out]);
+        m_compactProg->use();
+        glDispatchComputeIndirect(0);
+        in = out;
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    GL_CHECK_ERROR;
+}
\ No newline at end of file
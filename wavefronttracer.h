@@ -0,0 +1,56 @@
+#ifndef WAVEFRONT_TRACER_H
+#define WAVEFRONT_TRACER_H
+
+#pragma once
+
+#include "glslprogram.h"
+
+#include <glad/glad.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// drives the wavefront kernels of raytracing.fs. A sample of every pixel is
+// traced by generating the camera rays, then extending, shading and
+// compacting the paths still alive once per bounce. The kernels pass the
+// path indices through queues in ssbos, the extend, shade and compact
+// kernels are dispatched indirectly with the group counts the kernels
+// filling the queues write. Sorting the materials bins the extended paths
+// into a queue per material, so that the shading does not diverge
+class WavefrontTracer
+{
+public:
+    // compile and link raytracing.fs as a compute shader with the scene
+    // defines and the given ones, and set the scene uniforms
+    using createProgram_t = std::function<std::unique_ptr<GLSLProgram>(const std::vector<std::string>&)>;
+
+    WavefrontTracer(int width, int height, bool sortMaterials, const createProgram_t& createProgram);
+    ~WavefrontTracer();
+
+    // add the sample to the image bound to image unit 0
+    void render(int sample);
+private:
+    void resetQueue(GLuint queue, GLintptr offset = 0);
+    void shade(GLuint queue);
+
+    std::unique_ptr<GLSLProgram> m_generateProg;
+    std::unique_ptr<GLSLProgram> m_extendProg;
+    std::unique_ptr<GLSLProgram> m_shadeProg;
+    // null unless the materials are sorted
+    std::unique_ptr<GLSLProgram> m_sortProg;
+    std::unique_ptr<GLSLProgram> m_compactProg;
+
+    int m_width;
+    int m_height;
+
+    GLuint m_pathBuffer;
+    GLuint m_hitBuffer;
+    // the queue the current bounce consumes and the one it fills
+    GLuint m_queues[2];
+    // the material queues one after the other, m_materialQueueStride bytes apart
+    GLuint m_materialQueues;
+    GLintptr m_materialQueueStride;
+};
+
+#endif // WAVEFRONT_TRACER_H
\ No newline at end of file